@@ -6,6 +6,7 @@
 //
 
 #include "misc.h"
+#include "ostraps.h"
 
 //----------------------------------------------------------------------
 //
@@ -240,10 +241,23 @@ dstrtol (char *c,  char **newpos, int base)
 //	bcopy: Copy bytes from one location to another.
 //	bzero: Set all the bytes in a region to zero.
 //
+//	In the OS (built with MISC_BULK), anything longer than a few
+//	bytes is handed to the simulator, which does it all at once.
+//	That only works on physical addresses; if the simulator says no,
+//	do it a byte at a time.  The misc.o given to user programs is
+//	built without MISC_BULK, since the traps are OS-only.
+//
 //----------------------------------------------------------------------
+#define	MISC_BULK_MIN	16
+
 void
 bcopy (char *src, char *dst, int count)
 {
+#ifdef MISC_BULK
+  if ((count >= MISC_BULK_MIN) && (bulkmove (dst, src, count) == count)) {
+    return;
+  }
+#endif
   while (count-- > 0) {
     *(dst++) = *(src++);
   }
@@ -252,6 +266,11 @@ bcopy (char *src, char *dst, int count)
 void
 bzero (char *dst, int count)
 {
+#ifdef MISC_BULK
+  if ((count >= MISC_BULK_MIN) && (bulkset (dst, 0, count) == count)) {
+    return;
+  }
+#endif
   while (count-- > 0) {
     *(dst++) = 0;
   }
@@ -21,3 +21,52 @@ _srandom:
 	nop
 .endproc _srandom
 
+;
+; Copy (bulkmove) or fill (bulkset) a range of physical memory in one
+; step.  Arguments are as for memmove and memset.  Return the number
+; of bytes done, or 0 if the simulator couldn't (or doesn't know how)
+; and the caller has to do it itself.
+;
+.proc _bulkmove
+.global _bulkmove
+_bulkmove:
+	add	r1,r0,r0
+	trap	#0x2102
+	jr	r31
+	nop
+.endproc _bulkmove
+
+.proc _bulkset
+.global _bulkset
+_bulkset:
+	add	r1,r0,r0
+	trap	#0x2103
+	jr	r31
+	nop
+.endproc _bulkset
+
+;
+; Read a performance counter (see PERF_* in ostraps.h).  The simulator
+; takes the counter number in r1.
+;
+.proc _perfcounter
+.global _perfcounter
+_perfcounter:
+	lw	r1,0(r29)
+	trap	#0x2104
+	jr	r31
+	nop
+.endproc _perfcounter
+
+;
+; Read a page heat map count (see HEAT_* in ostraps.h).  The simulator
+; takes HEAT_COUNTER(page, kind) in r1.
+;
+.proc _heatcount
+.global _heatcount
+_heatcount:
+	lw	r1,0(r29)
+	trap	#0x2105
+	jr	r31
+	nop
+.endproc _heatcount
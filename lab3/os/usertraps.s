@@ -250,3 +250,14 @@ _Exit:
 	jr	r31
 	nop
 .endproc _Exit
+
+;;; PerfCounter is handled by the simulator itself rather than the OS,
+;;; so it takes its argument in r1 instead of on the (virtual) stack.
+.proc _PerfCounter
+.global _PerfCounter
+_PerfCounter:
+	lw	r1,0(r29)
+	trap	#0x2104
+	jr	r31
+	nop
+.endproc _PerfCounter
@@ -36,6 +36,7 @@ extern char  debugstr[];
 
 extern int  CurrentIntrs ();
 extern int  SetIntrs (int);
+extern int  SpinTryLock (volatile int *);
 extern void  KbdModuleInit ();
 extern void  intrreturn ();
 
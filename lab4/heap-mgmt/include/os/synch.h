@@ -65,6 +65,15 @@ int CondInit(Cond *);
 int CondWait(Cond *);
 int CondSignal(Cond *);
 
+// Spinlocks protect short stretches of code against other CPUs; they
+// busy-wait, so never sleep while holding one.  Pair them with
+// DisableIntrs to keep out interrupt handlers on the same CPU too.
+typedef volatile int SpinLock;
+
+void SpinLockInit(SpinLock *);
+void SpinLockAcquire(SpinLock *);
+void SpinLockRelease(SpinLock *);
+
 int SynchModuleInit();
 
 sem_t SemCreate(int count);
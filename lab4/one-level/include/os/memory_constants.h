@@ -42,4 +42,9 @@
 
 #define MEM_PTE_MASK ~(MEM_PTE_READONLY | MEM_PTE_DIRTY | MEM_PTE_VALID)
 
+// Set to 1 to run user processes with the software-loaded TLB instead of
+// having the simulator walk the page table.  The page table is still
+// kept; the TLB refill handler loads entries from it.
+#define MEM_USE_TLB 0
+
 #endif	// _memory_constants_h_
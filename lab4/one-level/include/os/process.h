@@ -19,7 +19,11 @@
 #define	PROCESS_MAX_PROCS	32	// Maximum number of active processes
 
 #define	PROCESS_INIT_ISR_SYS	0x140	// Initial status reg value for system processes
+#if MEM_USE_TLB
+#define	PROCESS_INIT_ISR_USER	0x200	// Initial status reg value for user processes
+#else
 #define	PROCESS_INIT_ISR_USER	0x100	// Initial status reg value for user processes
+#endif
 
 #define	PROCESS_STATUS_FREE	0x1
 #define	PROCESS_STATUS_RUNNABLE	0x2
@@ -95,6 +95,17 @@
 #define	DLX_KBD_NCHARSIN	0xfff001a0
 #define	DLX_KBD_INTR		0xfff001c0
 
+// Software-loaded TLB registers (used when DLX_STATUS_TLB is set)
+#define	DLX_TLB_INDEX		0xfff00400
+#define	DLX_TLB_ENTRYHI		0xfff00404
+#define	DLX_TLB_ENTRYLO		0xfff00408
+#define	DLX_TLB_WRITE		0xfff0040c
+#define	DLX_TLB_REPLACE		0xfff00410
+#define	DLX_TLB_READ		0xfff00414
+#define	DLX_TLB_PROBE		0xfff00418
+#define	DLX_TLB_FLUSH		0xfff0041c
+#define	DLX_TLB_NENTRIES	0xfff00420
+
 #define	TRAP_STACK_SIZE		0x800	// interrupt stack is 2K words
 
 #endif	/* _dlxtraps_h_ */
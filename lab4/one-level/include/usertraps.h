@@ -68,6 +68,21 @@ void *malloc(int memsize);              //trap 0x467
 int mfree(void *ptr);                   //trap 0x468
 
 
+// Performance counters, for PerfCounter().  Instructions and
+// microseconds are 64 bits, read as two halves.  PERF_EXC + cause
+// counts exceptions with that cause (below 0x7f); PERF_EXC_TRAPS
+// counts all traps.
+#define PERF_INSTRS_LO 16
+#define PERF_INSTRS_HI 17
+#define PERF_US_LO 18
+#define PERF_US_HI 19
+#define PERF_WALKS 20
+#define PERF_LOADS 21
+#define PERF_STORES 22
+#define PERF_EXC 0x100
+#define PERF_EXC_TRAPS (PERF_EXC + 0x7f)
+unsigned int PerfCounter(int counter);    //trap 0x2104, handled by dlxsim
+
 #ifndef NULL
 #define NULL (void *)0x0
 #endif
@@ -6,6 +6,7 @@
 //static char rcsid[] = "$Id: memory.c,v 1.1 2000/09/20 01:50:19 elm Exp elm $";
 
 #include "ostraps.h"
+#include "traps.h"
 #include "dlxos.h"
 #include "process.h"
 #include "memory.h"
@@ -233,6 +234,39 @@ int MemoryPageFaultHandler(PCB *pcb) {
 }
 
 
+//---------------------------------------------------------------------
+// MemoryTlbRefillHandler
+//
+// Called on a TLB miss when user processes run with the software-loaded
+// TLB (MEM_USE_TLB).  Loads the PTE for the faulting page from the
+// process's page table into the TLB, taking a page fault first if the
+// page isn't mapped yet.  The simulator picks which entry to replace.
+//---------------------------------------------------------------------
+int MemoryTlbRefillHandler(PCB *pcb) {
+  uint32 addr = pcb->currentSavedFrame[PROCESS_STACK_FAULT];
+  uint32 vpagenum = addr >> MEM_L1FIELD_FIRST_BITNUM;
+
+  if (vpagenum >= MEM_L1TABLE_SIZE) {
+    printf("FATAL ERROR (%d): TLB miss outside address space at %x\n", findpid(pcb), addr);
+    ProcessKill();
+    return MEM_FAIL;
+  }
+
+  if ((pcb->pagetable[vpagenum] & MEM_PTE_VALID) == 0) {
+    if (MemoryPageFaultHandler(pcb) == MEM_FAIL) {
+      return MEM_FAIL;
+    }
+  }
+
+  dbprintf('m', "TLB refill: vpage %d -> pte %x\n", vpagenum, pcb->pagetable[vpagenum]);
+  *((uint32 *)DLX_TLB_ENTRYHI) = vpagenum << MEM_L1FIELD_FIRST_BITNUM;
+  *((uint32 *)DLX_TLB_ENTRYLO) = pcb->pagetable[vpagenum];
+  *((uint32 *)DLX_TLB_REPLACE) = 0;
+
+  return MEM_SUCCESS;
+}
+
+
 //---------------------------------------------------------------------
 // You may need to implement the following functions and access them from process.c
 // Feel free to edit/remove them
@@ -14,6 +14,7 @@
 static Sem sems[MAX_SEMS]; 	// All semaphores in the system
 static Lock locks[MAX_LOCKS];   // All locks in the system
 static Cond conds[MAX_LOCKS];   // All conds in the system
+static SpinLock tablesLock;     // Protects the inuse flags above
 
 extern struct PCB *currentPCB; 
 //----------------------------------------------------------------------
@@ -34,10 +35,36 @@ int SynchModuleInit() {
   for(i=0; i<MAX_CONDS; i++) {
     conds[i].inuse = 0;
   }
+  SpinLockInit (&tablesLock);
   dbprintf ('p', "SynchModuleInit: Leaving SynchModuleInit\n");
   return SYNC_SUCCESS;
 }
 
+//----------------------------------------------------------------------
+//	SpinLockInit, SpinLockAcquire, SpinLockRelease
+//
+//	Busy-waiting locks built on SpinTryLock (in dlxos.s), which uses
+//	the simulator's ll/sc instructions.  Disabling interrupts only
+//	keeps out the current CPU, so code that other CPUs can run at the
+//	same time (see DLXSIM_CPUS in the simulator) also needs one of
+//	these.  While the lock is held, wait with ordinary loads so that
+//	the waiting CPUs don't keep breaking each other's reservations.
+//----------------------------------------------------------------------
+void SpinLockInit (SpinLock *l) {
+  *l = 0;
+}
+
+void SpinLockAcquire (SpinLock *l) {
+  while (!SpinTryLock (l)) {
+    while (*l != 0) {
+    }
+  }
+}
+
+void SpinLockRelease (SpinLock *l) {
+  *l = 0;
+}
+
 //---------------------------------------------------------------------
 //
 //	SemInit
@@ -69,12 +96,14 @@ sem_t SemCreate(int count) {
 
   // grabbing a semaphore should be an atomic operation
   intrval = DisableIntrs();
+  SpinLockAcquire (&tablesLock);
   for(sem=0; sem<MAX_SEMS; sem++) {
     if(sems[sem].inuse==0) {
       sems[sem].inuse = 1;
       break;
     }
   }
+  SpinLockRelease (&tablesLock);
   RestoreIntrs(intrval);
   if(sem==MAX_SEMS) return SYNC_FAIL;
 
@@ -202,12 +231,14 @@ lock_t LockCreate() {
 
   // grabbing a lock should be an atomic operation
   intrval = DisableIntrs();
+  SpinLockAcquire (&tablesLock);
   for(l=0; l<MAX_LOCKS; l++) {
     if(locks[l].inuse==0) {
       locks[l].inuse = 1;
       break;
     }
   }
+  SpinLockRelease (&tablesLock);
   RestoreIntrs(intrval);
   if(l==MAX_LOCKS) return SYNC_FAIL;
 
@@ -347,12 +378,14 @@ cond_t CondCreate(lock_t lock) {
 
   // grabbing a cond should be an atomic operation
   intrval = DisableIntrs();
+  SpinLockAcquire (&tablesLock);
   for(c=0; c<MAX_LOCKS; c++) {
     if (conds[c].inuse==0) {
       conds[c].inuse = 1;
       break;
     }
   }
+  SpinLockRelease (&tablesLock);
   RestoreIntrs(intrval);
   if(c==MAX_CONDS) return SYNC_FAIL;
 
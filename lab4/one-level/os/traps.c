@@ -255,6 +255,7 @@ static void TrapPrintfHandler(uint32 *trapArgs, int sysMode) {
                   }
                   numargs += 2; // numargs is incremented by 2 since a double is the size of 2 ints
           break;
+        case 'u': // unsigned integers, same size as %d
         case 'd': // integers
                   if (!sysMode) {
                     MemoryCopyUserToSystem(currentPCB, (char *)(trapArgs+numargs+1), (char *)&(args[numargs]), sizeof(int));
@@ -532,6 +533,9 @@ dointerrupt (unsigned int cause, unsigned int iar, unsigned int isr,
     case TRAP_PAGEFAULT:
       MemoryPageFaultHandler(currentPCB);
       break;
+    case TRAP_TLBFAULT:
+      MemoryTlbRefillHandler(currentPCB);
+      break;
     default:
       printf ("Got an unrecognized system interrupt (0x%x) - exiting!\n",
 	      cause);
@@ -0,0 +1,212 @@
+//
+//	dlxbatch.cc
+//
+//	Run many independent simulations at once.
+//
+//	Usage: dlxbatch [-j jobs] [-s simulator] manifest
+//
+//	Each non-blank line of the manifest that doesn't start with '#'
+//	is one job:
+//
+//		output-file [NAME=value ...] dlxsim-arguments ...
+//
+//	The simulator (dlxsim by default, found on the PATH) is run with
+//	the given arguments and environment settings, with its stdin
+//	taken from /dev/null and its stdout and stderr sent to the output
+//	file.  Up to -j jobs (default: one per host CPU) run at a time.
+//
+//	Each job is a separate process, since the simulator keeps its
+//	state in globals.  Binary OS images (see dlxobj2bin) are mmapped
+//	by the simulator, so concurrent jobs share one copy of the image
+//	in the page cache instead of each parsing the text file.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#define	DLX_BATCH_MAX_ARGS	64
+
+typedef struct BatchJob {
+  int		line;		// line number in the manifest
+  char		*output;
+  char		*argv[DLX_BATCH_MAX_ARGS + 2];
+  char		*env[DLX_BATCH_MAX_ARGS];
+  int		nenv;
+  pid_t		pid;
+  double	started;
+} BatchJob;
+
+static
+double
+Now ()
+{
+  struct timeval	t;
+
+  gettimeofday (&t, NULL);
+  return ((double)t.tv_sec + (double)t.tv_usec * 1e-6);
+}
+
+//----------------------------------------------------------------------
+//
+//	ParseJob
+//
+//	Split a manifest line into a job.  The line is modified in place
+//	and must stay allocated.  Returns 0 for blank and comment lines.
+//
+//----------------------------------------------------------------------
+static
+int
+ParseJob (char *line, const char *sim, BatchJob *job)
+{
+  char		*word;
+  int		argc = 1;
+
+  job->output = NULL;
+  job->nenv = 0;
+  job->argv[0] = (char *)sim;
+  for (word = strtok (line, " \t\n"); word != NULL;
+       word = strtok (NULL, " \t\n")) {
+    if ((job->output == NULL) && (word[0] == '#')) {
+      return (0);
+    } else if (job->output == NULL) {
+      job->output = word;
+    } else if ((argc == 1) && (strchr (word, '=') != NULL) &&
+	       (isalpha (word[0]) || (word[0] == '_'))) {
+      if (job->nenv < DLX_BATCH_MAX_ARGS) {
+	job->env[job->nenv++] = word;
+      }
+    } else if (argc <= DLX_BATCH_MAX_ARGS) {
+      job->argv[argc++] = word;
+    }
+  }
+  job->argv[argc] = NULL;
+  return (job->output != NULL);
+}
+
+static
+pid_t
+StartJob (BatchJob *job)
+{
+  pid_t		pid;
+  int		fd, i;
+
+  if ((pid = fork ()) != 0) {
+    return (pid);
+  }
+  if ((fd = open (job->output, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+    perror (job->output);
+    _exit (127);
+  }
+  dup2 (fd, 1);
+  dup2 (fd, 2);
+  close (fd);
+  if ((fd = open ("/dev/null", O_RDONLY)) >= 0) {
+    dup2 (fd, 0);
+    close (fd);
+  }
+  for (i = 0; i < job->nenv; i++) {
+    putenv (job->env[i]);
+  }
+  execvp (job->argv[0], job->argv);
+  perror (job->argv[0]);
+  _exit (127);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char	*sim = "dlxsim";
+  int		maxJobs = sysconf (_SC_NPROCESSORS_ONLN);
+  FILE		*fp;
+  char		buf[1024];
+  BatchJob	*jobs = NULL;
+  int		njobs = 0, maxAlloc = 0, next = 0, running = 0, failed = 0;
+  int		c, i, status, lineno = 0;
+  pid_t		pid;
+  double	start = Now ();
+
+  while ((c = getopt (argc, argv, "j:s:")) != -1) {
+    switch (c) {
+    case 'j':
+      maxJobs = atoi (optarg);
+      break;
+    case 's':
+      sim = optarg;
+      break;
+    default:
+      fprintf (stderr, "Usage: %s [-j jobs] [-s simulator] manifest\n",
+	       argv[0]);
+      exit (1);
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf (stderr, "Usage: %s [-j jobs] [-s simulator] manifest\n",
+	     argv[0]);
+    exit (1);
+  }
+  if (maxJobs < 1) {
+    maxJobs = 1;
+  }
+  if ((fp = fopen (argv[optind], "r")) == NULL) {
+    perror (argv[optind]);
+    exit (1);
+  }
+  while (fgets (buf, sizeof (buf), fp) != NULL) {
+    lineno++;
+    if (njobs == maxAlloc) {
+      maxAlloc = (maxAlloc == 0) ? 64 : maxAlloc * 2;
+      jobs = (BatchJob *)realloc (jobs, maxAlloc * sizeof (BatchJob));
+    }
+    jobs[njobs].line = lineno;
+    if (ParseJob (strdup (buf), sim, &jobs[njobs])) {
+      njobs++;
+    }
+  }
+  fclose (fp);
+
+  while ((next < njobs) || (running > 0)) {
+    while ((next < njobs) && (running < maxJobs)) {
+      jobs[next].started = Now ();
+      if ((jobs[next].pid = StartJob (&jobs[next])) < 0) {
+	perror ("fork");
+	exit (1);
+      }
+      running++;
+      next++;
+    }
+    if ((pid = wait (&status)) < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      break;
+    }
+    for (i = 0; (i < next) && (jobs[i].pid != pid); i++) {
+    }
+    if (i == next) {
+      continue;
+    }
+    running--;
+    if (!WIFEXITED (status) || (WEXITSTATUS (status) != 0)) {
+      failed++;
+      printf ("FAIL line %d: %s (%s %d) %.2fs\n", jobs[i].line,
+	      jobs[i].output, WIFEXITED (status) ? "exit" : "signal",
+	      WIFEXITED (status) ? WEXITSTATUS (status) : WTERMSIG (status),
+	      Now () - jobs[i].started);
+    } else {
+      printf ("ok   line %d: %s %.2fs\n", jobs[i].line, jobs[i].output,
+	      Now () - jobs[i].started);
+    }
+    fflush (stdout);
+  }
+  printf ("%d jobs, %d failed, %.2f secs with up to %d at a time.\n",
+	  njobs, failed, Now () - start, maxJobs);
+  return (failed ? 1 : 0);
+}
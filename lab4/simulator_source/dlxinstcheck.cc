@@ -0,0 +1,696 @@
+//
+//	dlxinstcheck.cc
+//
+//	Check the simulator's instruction handlers against a reference
+//	model, and measure how fast they run.
+//
+//	Usage: dlxinstcheck [-n count] [-s seed] [-b instrs]
+//
+//	The check runs count (default 1000000) random instructions, one
+//	at a time, from the families whose handlers dlxsim.cc generates
+//	from tables: integer ALU operations, loads and stores, branches
+//	and jumps, and FP compares.  Before each one the registers,
+//	FPTRUE and the data word it may touch are set to random values.
+//	Afterwards the registers, FPTRUE, PC, exception cause and that
+//	word must match what CheckModel says.  CheckModel is a plain
+//	switch over the opcodes, written separately from the handlers.
+//	The first mismatch is printed and the exit status is 1.
+//
+//	-b instead runs a loop of common integer instructions (loads,
+//	stores, ALU operations, a branch and a jump) for instrs
+//	instructions and prints the rate in millions of instructions
+//	per second.  DLXSIM_BLOCKS and the simulator's other settings
+//	apply to it as usual; the check always runs without blocks.
+//
+//	The program drives a Cpu through its public interface, so it's
+//	linked with dlxsim.o like the simulator itself, in place of the
+//	object that holds main and the terminal I/O.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "dlx.h"
+
+#define	CHECK_MEMSIZE		(1 << 20)
+#define	CHECK_CODE		0x1000	// where each instruction is run
+#define	CHECK_VECTOR		0x2000	// interrupt vector
+#define	CHECK_DATA		0x8000	// loads and stores land near here
+#define	CHECK_DATA_SPAN		0x400
+
+// How the fields of each kind of instruction are filled in
+#define	CHECK_RRR		0	// opcode 0, code is the function
+#define	CHECK_FP		1	// opcode 1, code is the function
+#define	CHECK_IMM		2	// I-format ALU operation
+#define	CHECK_MEM		3	// load or store
+#define	CHECK_BRANCH		4	// I-format branch
+#define	CHECK_JUMP		5	// J-format jump
+#define	CHECK_JREG		6	// jump to a register
+
+typedef struct CheckInst {
+  const char	*name;
+  int		kind;
+  uint32	code;		// opcode, or function for CHECK_RRR/CHECK_FP
+} CheckInst;
+
+static const CheckInst	checkInsts[] = {
+  {"sll", CHECK_RRR, 0x04},	{"srl", CHECK_RRR, 0x06},
+  {"sra", CHECK_RRR, 0x07},	{"add", CHECK_RRR, 0x20},
+  {"addu", CHECK_RRR, 0x21},	{"sub", CHECK_RRR, 0x22},
+  {"subu", CHECK_RRR, 0x23},	{"and", CHECK_RRR, 0x24},
+  {"or", CHECK_RRR, 0x25},	{"xor", CHECK_RRR, 0x26},
+  {"seq", CHECK_RRR, 0x28},	{"sne", CHECK_RRR, 0x29},
+  {"slt", CHECK_RRR, 0x2a},	{"sgt", CHECK_RRR, 0x2b},
+  {"sle", CHECK_RRR, 0x2c},	{"sge", CHECK_RRR, 0x2d},
+  {"addi", CHECK_IMM, 0x08},	{"addui", CHECK_IMM, 0x09},
+  {"subi", CHECK_IMM, 0x0a},	{"subui", CHECK_IMM, 0x0b},
+  {"andi", CHECK_IMM, 0x0c},	{"ori", CHECK_IMM, 0x0d},
+  {"xori", CHECK_IMM, 0x0e},	{"lhi", CHECK_IMM, 0x0f},
+  {"slli", CHECK_IMM, 0x14},	{"srli", CHECK_IMM, 0x16},
+  {"srai", CHECK_IMM, 0x17},	{"seqi", CHECK_IMM, 0x18},
+  {"snei", CHECK_IMM, 0x19},	{"slti", CHECK_IMM, 0x1a},
+  {"sgti", CHECK_IMM, 0x1b},	{"slei", CHECK_IMM, 0x1c},
+  {"sgei", CHECK_IMM, 0x1d},
+  {"lb", CHECK_MEM, 0x20},	{"lh", CHECK_MEM, 0x21},
+  {"lw", CHECK_MEM, 0x23},	{"lbu", CHECK_MEM, 0x24},
+  {"lhu", CHECK_MEM, 0x25},	{"lf", CHECK_MEM, 0x26},
+  {"sb", CHECK_MEM, 0x28},	{"sh", CHECK_MEM, 0x29},
+  {"sw", CHECK_MEM, 0x2b},	{"sf", CHECK_MEM, 0x2e},
+  {"beqz", CHECK_BRANCH, 0x04},	{"bnez", CHECK_BRANCH, 0x05},
+  {"bfpt", CHECK_BRANCH, 0x06},	{"bfpf", CHECK_BRANCH, 0x07},
+  {"j", CHECK_JUMP, 0x02},	{"jal", CHECK_JUMP, 0x03},
+  {"jr", CHECK_JREG, 0x12},	{"jalr", CHECK_JREG, 0x13},
+  {"eqf", CHECK_FP, 0x10},	{"nef", CHECK_FP, 0x11},
+  {"ltf", CHECK_FP, 0x12},	{"gtf", CHECK_FP, 0x13},
+  {"lef", CHECK_FP, 0x14},	{"gef", CHECK_FP, 0x15},
+  {"eqd", CHECK_FP, 0x18},	{"ned", CHECK_FP, 0x19},
+  {"ltd", CHECK_FP, 0x1a},	{"gtd", CHECK_FP, 0x1b},
+  {"led", CHECK_FP, 0x1c},	{"ged", CHECK_FP, 0x1d},
+};
+
+#define	CHECK_NINSTS	(sizeof (checkInsts) / sizeof (checkInsts[0]))
+
+typedef struct CheckState {
+  uint32	ireg[32];
+  uint32	freg[32];
+  int		fptrue;
+  uint32	pc;
+  uint32	cause;		// 0 if there was no exception
+  uint32	dataAddr;	// word a load or store touches
+  uint32	data;
+} CheckState;
+
+static
+uint32
+Random32 ()
+{
+  return (((uint32)random () << 16) ^ (uint32)random ());
+}
+
+//----------------------------------------------------------------------
+//
+//	RandomValue
+//	RandomFpValue
+//
+//	Register contents for a check.  Values at the edges of the
+//	arithmetic (and, for FP, zeros, infinities and NaNs) come up
+//	often enough that every comparison outcome and every overflow
+//	case gets tried.
+//
+//----------------------------------------------------------------------
+static
+uint32
+RandomValue ()
+{
+  static const uint32	edges[] = {
+    0, 1, 2, 0x1f, 0x20, 0x7fff, 0x8000, 0xffff, 0x10000,
+    0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff,
+  };
+
+  if ((random () % 4) == 0) {
+    return (edges[random () % (sizeof (edges) / sizeof (edges[0]))]);
+  }
+  return (Random32 ());
+}
+
+static
+void
+RandomFpValue (uint32 *freg, int r)
+{
+  static const float	floats[] = {0.0, -0.0, 1.0, -1.0, 2.5, 1e30};
+  static const double	doubles[] = {0.0, -0.0, 1.0, -1.0, 2.5, 1e300};
+  float		f;
+  double	d;
+
+  switch (random () % 4) {
+  case 0:
+    f = floats[random () % (sizeof (floats) / sizeof (floats[0]))];
+    memcpy (&freg[r], &f, sizeof (f));
+    break;
+  case 1:
+    if ((r & 1) == 0) {
+      d = doubles[random () % (sizeof (doubles) / sizeof (doubles[0]))];
+      memcpy (&freg[r], &d, sizeof (d));
+      break;
+    }
+    // fall through
+  default:
+    // Random bits; these include infinities and NaNs now and then.
+    freg[r] = Random32 ();
+    break;
+  }
+}
+
+static
+void
+CheckPutIreg (CheckState *s, uint32 r, uint32 v)
+{
+  if (r != 0) {
+    s->ireg[r] = v;
+  }
+}
+
+static
+void
+CheckFault (CheckState *s, uint32 cause)
+{
+  s->cause = cause;
+  s->pc = CHECK_VECTOR;
+}
+
+static
+void
+CheckJump (CheckState *s, uint32 target)
+{
+  if ((target & 0x3) != 0) {
+    CheckFault (s, DLX_EXC_ADDRESS);
+  } else {
+    s->pc = target;
+  }
+}
+
+static
+int
+CheckCompare (int func, double v1, double v2)
+{
+  switch (func & 0x7) {
+  case 0:	return (v1 == v2);
+  case 1:	return (v1 != v2);
+  case 2:	return (v1 < v2);
+  case 3:	return (v1 > v2);
+  case 4:	return (v1 <= v2);
+  default:	return (v1 >= v2);
+  }
+}
+
+//----------------------------------------------------------------------
+//
+//	CheckModel
+//
+//	What inst should do to *s, which holds the state before it runs
+//	at s->pc.  Only the instructions in checkInsts are modelled.
+//	The destination of an ALU operation is written even if it
+//	overflows.  J-format offsets are 25 bits, sign extended, as
+//	dlxsim has always taken them.
+//
+//----------------------------------------------------------------------
+static
+void
+CheckModel (CheckState *s, uint32 inst)
+{
+  uint32	op = (inst >> DLX_OPCODE_SHIFT) & DLX_OPCODE_MASK;
+  uint32	rs1 = (inst >> DLX_RFMT_SRC1_SHIFT) & DLX_REG_MASK;
+  uint32	rs2 = (inst >> DLX_RFMT_SRC2_SHIFT) & DLX_REG_MASK;
+  uint32	rd = (inst >> DLX_RFMT_DST_SHIFT) & DLX_REG_MASK;
+  uint32	imm = (inst >> DLX_IFMT_IMM_SHIFT) & 0xffff;
+  uint32	simm = (imm & 0x8000) ? (imm | 0xffff0000) : imm;
+  uint32	a = s->ireg[rs1];
+  uint32	b, r, func, addr, shift, mask, val, off;
+  int		overflow = 0;
+  float		f1, f2;
+  double	d1, d2;
+
+  s->pc += 4;
+  if (op == 0x00) {
+    func = (inst >> DLX_ALU_FUNC_CODE_SHIFT) & DLX_ALU_FUNC_CODE_MASK;
+    b = s->ireg[rs2];
+  } else if (op == 0x01) {
+    func = (inst >> DLX_FPU_FUNC_CODE_SHIFT) & DLX_FPU_FUNC_CODE_MASK;
+    if (func < 0x18) {
+      memcpy (&f1, &s->freg[rs1], sizeof (f1));
+      memcpy (&f2, &s->freg[rs2], sizeof (f2));
+      s->fptrue = CheckCompare (func, f1, f2);
+    } else {
+      memcpy (&d1, &s->freg[rs1], sizeof (d1));
+      memcpy (&d2, &s->freg[rs2], sizeof (d2));
+      s->fptrue = CheckCompare (func, d1, d2);
+    }
+    return;
+  } else {
+    // I-format ALU operations: the same functions as R-R ones, with
+    // the immediate as the second operand.
+    rd = rs2;
+    switch (op) {
+    case 0x08: func = 0x20; b = simm; break;
+    case 0x09: func = 0x21; b = imm; break;
+    case 0x0a: func = 0x22; b = simm; break;
+    case 0x0b: func = 0x23; b = imm; break;
+    case 0x0c: func = 0x24; b = imm; break;
+    case 0x0d: func = 0x25; b = imm; break;
+    case 0x0e: func = 0x26; b = imm; break;
+    case 0x0f: CheckPutIreg (s, rd, imm << 16); return;
+    case 0x14: func = 0x04; b = imm; break;
+    case 0x16: func = 0x06; b = imm; break;
+    case 0x17: func = 0x07; b = imm; break;
+    case 0x18: func = 0x28; b = simm; break;
+    case 0x19: func = 0x29; b = simm; break;
+    case 0x1a: func = 0x2a; b = simm; break;
+    case 0x1b: func = 0x2b; b = simm; break;
+    case 0x1c: func = 0x2c; b = simm; break;
+    case 0x1d: func = 0x2d; b = simm; break;
+    default: func = 0; b = 0; break;
+    }
+  }
+
+  switch (op) {
+  case 0x00:
+  case 0x08: case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d:
+  case 0x0e: case 0x14: case 0x16: case 0x17: case 0x18: case 0x19:
+  case 0x1a: case 0x1b: case 0x1c: case 0x1d:
+    switch (func) {
+    case 0x04: r = a << (b & 0x1f); break;
+    case 0x06: r = a >> (b & 0x1f); break;
+    case 0x07: r = (uint32)((int)a >> (b & 0x1f)); break;
+    case 0x20:
+    case 0x21:
+      r = a + b;
+      overflow = (func == 0x20) && (((a ^ b) & 0x80000000) == 0) &&
+	(((a ^ r) & 0x80000000) != 0);
+      break;
+    case 0x22:
+    case 0x23:
+      r = a - b;
+      overflow = (func == 0x22) && (((a ^ b) & 0x80000000) != 0) &&
+	(((a ^ r) & 0x80000000) != 0);
+      break;
+    case 0x24: r = a & b; break;
+    case 0x25: r = a | b; break;
+    case 0x26: r = a ^ b; break;
+    case 0x28: r = (a == b); break;
+    case 0x29: r = (a != b); break;
+    case 0x2a: r = ((int)a < (int)b); break;
+    case 0x2b: r = ((int)a > (int)b); break;
+    case 0x2c: r = ((int)a <= (int)b); break;
+    default: r = ((int)a >= (int)b); break;
+    }
+    CheckPutIreg (s, rd, r);
+    if (overflow) {
+      CheckFault (s, DLX_EXC_OVERFLOW);
+    }
+    return;
+
+  case 0x20: case 0x21: case 0x23: case 0x24: case 0x25: case 0x26:
+  case 0x28: case 0x29: case 0x2b: case 0x2e:
+    addr = a + simm;
+    if ((op == 0x21) || (op == 0x25) || (op == 0x29)) {
+      shift = 16 - 8 * (addr & 0x2);
+      mask = 0xffff;
+      if ((addr & 0x1) != 0) {
+	CheckFault (s, DLX_EXC_ADDRESS);
+	return;
+      }
+    } else if ((op == 0x20) || (op == 0x24) || (op == 0x28)) {
+      shift = 24 - 8 * (addr & 0x3);
+      mask = 0xff;
+    } else {
+      shift = 0;
+      mask = 0xffffffff;
+      if ((addr & 0x3) != 0) {
+	CheckFault (s, DLX_EXC_ADDRESS);
+	return;
+      }
+    }
+    // Guest memory is big-endian: byte 0 is the top of the word.
+    switch (op) {
+    case 0x20:
+    case 0x21:
+      val = (s->data >> shift) & mask;
+      if (val & ((mask + 1) >> 1)) {
+	val |= ~mask;
+      }
+      CheckPutIreg (s, rs2, val);
+      break;
+    case 0x23:
+    case 0x24:
+    case 0x25:
+      CheckPutIreg (s, rs2, (s->data >> shift) & mask);
+      break;
+    case 0x26:
+      s->freg[rs2] = s->data;
+      break;
+    case 0x2e:
+      s->data = s->freg[rs2];
+      break;
+    default:
+      s->data = (s->data & ~(mask << shift)) |
+	((s->ireg[rs2] & mask) << shift);
+      break;
+    }
+    return;
+
+  case 0x04: case 0x05: case 0x06: case 0x07:
+    switch (op) {
+    case 0x04: r = (a == 0); break;
+    case 0x05: r = (a != 0); break;
+    case 0x06: r = s->fptrue; break;
+    default: r = !s->fptrue; break;
+    }
+    if (r) {
+      CheckJump (s, s->pc + simm);
+    }
+    return;
+
+  case 0x02:
+  case 0x03:
+    off = inst & 0x1ffffff;
+    if (off & 0x1000000) {
+      off |= 0xfe000000;
+    }
+    if (op == 0x03) {
+      CheckPutIreg (s, 31, s->pc);
+    }
+    CheckJump (s, s->pc + off);
+    return;
+
+  case 0x12:
+  case 0x13:
+    // The link is written first, so jalr r31 goes to the next
+    // instruction.
+    if (op == 0x13) {
+      CheckPutIreg (s, 31, s->pc);
+    }
+    CheckJump (s, s->ireg[rs1]);
+    return;
+  }
+}
+
+//----------------------------------------------------------------------
+//
+//	CheckMake
+//
+//	Pick a random instruction and a random state to run it in.
+//	Loads and stores get a base register that points into the data
+//	area, so that they never reach I/O space, and a small offset, so
+//	that they're misaligned now and then.
+//
+//----------------------------------------------------------------------
+static
+uint32
+CheckMake (CheckState *s, const CheckInst **which)
+{
+  const CheckInst *ci = &checkInsts[random () % CHECK_NINSTS];
+  uint32	rs1 = random () % 32;
+  uint32	rs2 = random () % 32;
+  uint32	rd = random () % 32;
+  uint32	imm = ((random () % 4) == 0) ? RandomValue () : Random32 ();
+  uint32	inst;
+  int		i;
+
+  imm &= 0xffff;
+  for (i = 0; i < 32; i++) {
+    s->ireg[i] = (i == 0) ? 0 : RandomValue ();
+    RandomFpValue (s->freg, i);
+  }
+  s->fptrue = random () % 2;
+  s->pc = CHECK_CODE;
+  s->cause = 0;
+  s->dataAddr = CHECK_DATA;
+  s->data = 0;
+  *which = ci;
+
+  switch (ci->kind) {
+  case CHECK_RRR:
+    return ((rs1 << DLX_RFMT_SRC1_SHIFT) | (rs2 << DLX_RFMT_SRC2_SHIFT) |
+	    (rd << DLX_RFMT_DST_SHIFT) |
+	    (ci->code << DLX_ALU_FUNC_CODE_SHIFT));
+  case CHECK_FP:
+    if (ci->code >= 0x18) {
+      // Doubles live in even/odd register pairs
+      rs1 &= ~1;
+      rs2 &= ~1;
+    }
+    return ((1 << DLX_OPCODE_SHIFT) | (rs1 << DLX_RFMT_SRC1_SHIFT) |
+	    (rs2 << DLX_RFMT_SRC2_SHIFT) | (rd << DLX_RFMT_DST_SHIFT) |
+	    (ci->code << DLX_FPU_FUNC_CODE_SHIFT));
+  case CHECK_MEM:
+    rs1 = 1 + random () % 31;
+    s->ireg[rs1] = CHECK_DATA + random () % CHECK_DATA_SPAN;
+    imm = ((random () % 256) - 128) & 0xffff;
+    s->dataAddr = (s->ireg[rs1] + ((imm & 0x8000) ? (imm | 0xffff0000) : imm))
+      & ~0x3;
+    s->data = RandomValue ();
+    // fall through
+  case CHECK_IMM:
+  case CHECK_BRANCH:
+    return ((ci->code << DLX_OPCODE_SHIFT) | (rs1 << DLX_IFMT_SRC_SHIFT) |
+	    (rs2 << DLX_IFMT_DST_SHIFT) | (imm << DLX_IFMT_IMM_SHIFT));
+  case CHECK_JUMP:
+    return ((ci->code << DLX_OPCODE_SHIFT) | (Random32 () & 0x3ffffff));
+  default:
+    inst = (ci->code << DLX_OPCODE_SHIFT) | (rs1 << DLX_RFMT_SRC1_SHIFT);
+    return (inst);
+  }
+}
+
+static
+void
+CheckLoad (Cpu *cpu, const CheckState *s, uint32 status, uint32 inst)
+{
+  int		i;
+
+  for (i = 1; i < 32; i++) {
+    cpu->PutIreg (i, s->ireg[i]);
+  }
+  for (i = 0; i < 32; i++) {
+    cpu->PutFreg (i, s->freg[i]);
+  }
+  cpu->PutSreg (DLX_SREG_STATUS, status);
+  if (s->fptrue) {
+    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
+  }
+  cpu->PutSreg (DLX_SREG_CAUSE, 0);
+  cpu->PutSreg (DLX_SREG_INTRVEC, CHECK_VECTOR);
+  cpu->WriteWord (s->dataAddr, s->data);
+  cpu->WriteWord (CHECK_CODE, inst);
+  cpu->SetPC (s->pc);
+}
+
+static
+void
+CheckRead (Cpu *cpu, CheckState *s)
+{
+  int		i;
+
+  for (i = 0; i < 32; i++) {
+    s->ireg[i] = cpu->GetIreg (i);
+    s->freg[i] = cpu->GetFreg (i);
+  }
+  s->fptrue = cpu->StatusBit (DLX_STATUS_FPTRUE) ? 1 : 0;
+  s->pc = cpu->PC ();
+  s->cause = cpu->GetSreg (DLX_SREG_CAUSE);
+  cpu->ReadWord (s->dataAddr, s->data);
+}
+
+//----------------------------------------------------------------------
+//
+//	CheckDiff
+//
+//	Print how the simulator's state differs from the model's.
+//
+//----------------------------------------------------------------------
+static
+void
+CheckDiff (const CheckState *got, const CheckState *want)
+{
+  int		i;
+
+  for (i = 0; i < 32; i++) {
+    if (got->ireg[i] != want->ireg[i]) {
+      fprintf (stderr, "  r%d: dlxsim 0x%08x, model 0x%08x\n", i,
+	       got->ireg[i], want->ireg[i]);
+    }
+    if (got->freg[i] != want->freg[i]) {
+      fprintf (stderr, "  f%d: dlxsim 0x%08x, model 0x%08x\n", i,
+	       got->freg[i], want->freg[i]);
+    }
+  }
+  if (got->fptrue != want->fptrue) {
+    fprintf (stderr, "  FPTRUE: dlxsim %d, model %d\n", got->fptrue,
+	     want->fptrue);
+  }
+  if (got->pc != want->pc) {
+    fprintf (stderr, "  PC: dlxsim 0x%x, model 0x%x\n", got->pc, want->pc);
+  }
+  if (got->cause != want->cause) {
+    fprintf (stderr, "  cause: dlxsim 0x%x, model 0x%x\n", got->cause,
+	     want->cause);
+  }
+  if (got->data != want->data) {
+    fprintf (stderr, "  word at 0x%x: dlxsim 0x%08x, model 0x%08x\n",
+	     want->dataAddr, got->data, want->data);
+  }
+}
+
+static
+int
+Check (Cpu *cpu, long count)
+{
+  CheckState	before, want, got;
+  const CheckInst *ci;
+  uint32	status, inst;
+  long		i;
+
+  status = cpu->GetSreg (DLX_SREG_STATUS) & ~DLX_STATUS_FPTRUE;
+  for (i = 0; i < count; i++) {
+    inst = CheckMake (&before, &ci);
+    CheckLoad (cpu, &before, status, inst);
+    cpu->ExecOne ();
+    want = before;
+    CheckModel (&want, inst);
+    got.dataAddr = want.dataAddr;
+    CheckRead (cpu, &got);
+    if (memcmp (&got, &want, sizeof (got)) != 0) {
+      fprintf (stderr, "Check %ld: %s (0x%08x) differs:\n", i, ci->name,
+	       inst);
+      CheckDiff (&got, &want);
+      return (1);
+    }
+  }
+  printf ("%ld instructions match the model.\n", count);
+  return (0);
+}
+
+//----------------------------------------------------------------------
+//
+//	Bench
+//
+//	Time a loop of common integer instructions.  r6 holds the base
+//	of the data area and r2 walks a 1KB window in it.
+//
+//----------------------------------------------------------------------
+#define	BENCH_R(func, s1, s2, d)					\
+  (((s1) << DLX_RFMT_SRC1_SHIFT) | ((s2) << DLX_RFMT_SRC2_SHIFT) |	\
+   ((d) << DLX_RFMT_DST_SHIFT) | ((func) << DLX_ALU_FUNC_CODE_SHIFT))
+#define	BENCH_I(op, s, d, imm)						\
+  (((op) << DLX_OPCODE_SHIFT) | ((s) << DLX_IFMT_SRC_SHIFT) |		\
+   ((d) << DLX_IFMT_DST_SHIFT) | (((imm) & 0xffff) << DLX_IFMT_IMM_SHIFT))
+#define	BENCH_J(op, off)						\
+  (((op) << DLX_OPCODE_SHIFT) | ((off) & 0x3ffffff))
+
+static const uint32	benchLoop[] = {
+  BENCH_R (0x21, 6, 2, 1),	// addu	r1,r6,r2
+  BENCH_I (0x23, 1, 3, 0),	// lw	r3,0(r1)
+  BENCH_R (0x21, 4, 3, 4),	// addu	r4,r4,r3
+  BENCH_I (0x0e, 4, 5, 0x55),	// xori	r5,r4,0x55
+  BENCH_I (0x2b, 1, 5, 4),	// sw	r5,4(r1)
+  BENCH_I (0x24, 1, 7, 1),	// lbu	r7,1(r1)
+  BENCH_R (0x2a, 7, 4, 8),	// slt	r8,r7,r4
+  BENCH_I (0x28, 1, 8, 2),	// sb	r8,2(r1)
+  BENCH_I (0x05, 8, 0, 0),	// bnez	r8,.+4
+  BENCH_I (0x09, 2, 2, 4),	// addui r2,r2,4
+  BENCH_I (0x0c, 2, 2, 0x3fc),	// andi	r2,r2,0x3fc
+  BENCH_J (0x02, -48),		// j	back to the top
+};
+
+#define	BENCH_NINSTS	(sizeof (benchLoop) / sizeof (benchLoop[0]))
+
+static
+double
+Now ()
+{
+  struct timeval	t;
+
+  gettimeofday (&t, NULL);
+  return ((double)t.tv_sec + (double)t.tv_usec * 1e-6);
+}
+
+static
+void
+Bench (Cpu *cpu, long count)
+{
+  unsigned	i;
+  long		n;
+  double	start, secs;
+
+  for (i = 0; i < BENCH_NINSTS; i++) {
+    cpu->WriteWord (CHECK_CODE + 4 * i, benchLoop[i]);
+  }
+  cpu->PutIreg (2, 0);
+  cpu->PutIreg (6, CHECK_DATA);
+  cpu->SetPC (CHECK_CODE);
+  start = Now ();
+  for (n = 0; n < count; n++) {
+    cpu->ExecOne ();
+  }
+  secs = Now () - start;
+  if (cpu->PC () - CHECK_CODE >= 4 * BENCH_NINSTS) {
+    fprintf (stderr, "Benchmark left its loop (PC=0x%x)!\n", cpu->PC ());
+  }
+  printf ("%ld instructions in %.3f s: %.1f MIPS\n", count, secs,
+	  (double)count / secs / 1e6);
+}
+
+// No console: stand-ins for the terminal I/O in the simulator's main
+// program.
+void
+Cpu::SetupRawIo ()
+{
+}
+
+int
+Cpu::GetCharIfAvail ()
+{
+  return (0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  Cpu		*cpu;
+  long		count = 1000000;
+  long		benchCount = 0;
+  int		c;
+
+  srandom (1);
+  while ((c = getopt (argc, argv, "n:s:b:")) != -1) {
+    switch (c) {
+    case 'n':
+      count = atol (optarg);
+      break;
+    case 's':
+      srandom (atoi (optarg));
+      break;
+    case 'b':
+      benchCount = atol (optarg);
+      break;
+    default:
+      fprintf (stderr, "Usage: %s [-n count] [-s seed] [-b instrs]\n",
+	       argv[0]);
+      exit (2);
+    }
+  }
+  // The keyboard thread would read our stdin.  The check steps one
+  // instruction at a time, but a translated block runs on past it.
+  setenv ("DLXSIM_KBD", "off", 0);
+  if (benchCount == 0) {
+    unsetenv ("DLXSIM_BLOCKS");
+  }
+  cpu = new Cpu (CHECK_MEMSIZE);
+  if (benchCount > 0) {
+    Bench (cpu, benchCount);
+    return (0);
+  }
+  return (Check (cpu, count));
+}
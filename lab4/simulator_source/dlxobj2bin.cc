@@ -0,0 +1,162 @@
+//
+//	dlxobj2bin.cc
+//
+//	Convert a DLX text object file (.dlx.obj) into the binary image
+//	format that dlxsim and the OS loader read without parsing.
+//
+//	Usage: dlxobj2bin input.dlx.obj output.dlx.bin
+//
+//	The binary image is a header of seven big-endian words (magic
+//	"DLXB", start, total size, code start, code size, data start,
+//	data size) followed by segments, each an address word, a length
+//	word and that many bytes, padded to a word boundary.  Contiguous
+//	lines of the text file are merged into a single segment.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+#define	DLX_BINIMAGE_MAGIC	0x444c5842	// "DLXB"
+#define	DLX_BINIMAGE_HDRWORDS	7
+
+typedef unsigned int uint32;
+
+static
+inline
+int
+getxvalue (int x)
+{
+  if ((x >= '0') && (x <= '9')) {
+    return (x - '0');
+  } else if ((x >= 'a') && (x <= 'f')) {
+    return (x + 10 - 'a');
+  } else if ((x >= 'A') && (x <= 'F')) {
+    return (x + 10 - 'A');
+  } else {
+    return (0);
+  }
+}
+
+static
+void
+PutWord (FILE *fp, uint32 w)
+{
+  putc ((w >> 24) & 0xff, fp);
+  putc ((w >> 16) & 0xff, fp);
+  putc ((w >> 8) & 0xff, fp);
+  putc (w & 0xff, fp);
+}
+
+//----------------------------------------------------------------------
+//
+//	FlushSegment
+//
+//	Write out the segment collected so far (if any).
+//
+//----------------------------------------------------------------------
+static
+void
+FlushSegment (FILE *fp, uint32 addr, const unsigned char *data, uint32 len)
+{
+  uint32	pad;
+
+  if (len == 0) {
+    return;
+  }
+  PutWord (fp, addr);
+  PutWord (fp, len);
+  fwrite (data, 1, len, fp);
+  for (pad = len; (pad % sizeof (uint32)) != 0; pad++) {
+    putc (0, fp);
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  FILE		*in, *out;
+  char		buffer[200];
+  char		*pos;
+  uint32	hdr[DLX_BINIMAGE_HDRWORDS];
+  uint32	addr = 0;
+  uint32	segAddr = 0;
+  uint32	segLen = 0;
+  uint32	segMax = 0x10000;
+  unsigned char	*seg;
+  int		i;
+
+  if (argc != 3) {
+    fprintf (stderr, "Usage: %s input.dlx.obj output.dlx.bin\n", argv[0]);
+    exit (1);
+  }
+  if ((in = fopen (argv[1], "r")) == NULL) {
+    perror (argv[1]);
+    exit (1);
+  }
+  if ((fgets (buffer, sizeof (buffer) - 1, in) == NULL) ||
+      (strstr (buffer, "start:") == NULL)) {
+    fprintf (stderr, "%s: missing start line (not a DLX executable?)\n",
+	     argv[1]);
+    exit (1);
+  }
+  // The start line holds start, total size, and the code & data
+  // section starts and sizes, in that order.
+  hdr[0] = DLX_BINIMAGE_MAGIC;
+  pos = strchr (buffer, ':') + 1;
+  for (i = 1; i < DLX_BINIMAGE_HDRWORDS; i++) {
+    hdr[i] = strtoul (pos, &pos, 16);
+  }
+  if ((out = fopen (argv[2], "w")) == NULL) {
+    perror (argv[2]);
+    exit (1);
+  }
+  for (i = 0; i < DLX_BINIMAGE_HDRWORDS; i++) {
+    PutWord (out, hdr[i]);
+  }
+  seg = (unsigned char *)malloc (segMax);
+  while (fgets (buffer, sizeof (buffer) - 1, in) != NULL) {
+    pos = buffer;
+    if (strchr (buffer, ':') == NULL) {
+      continue;
+    }
+    if (*pos != ':') {
+      addr = strtoul (pos, &pos, 16);
+    }
+    if (*pos != ':') {
+      fprintf (stderr, "Error reading data file near:\n%s\n", buffer);
+      exit (1);
+    }
+    // A jump to a new address starts a new segment.
+    if (addr != segAddr + segLen) {
+      FlushSegment (out, segAddr, seg, segLen);
+      segAddr = addr;
+      segLen = 0;
+    }
+    pos++;	// skip past colon
+    while (1) {
+      while (isspace (*pos)) {
+	pos++;
+      }
+      if (!(isxdigit (*pos) && isxdigit (*(pos+1)))) {
+	break;
+      }
+      if (segLen == segMax) {
+	segMax *= 2;
+	seg = (unsigned char *)realloc (seg, segMax);
+      }
+      seg[segLen++] = (getxvalue(*pos) * 16) + getxvalue(*(pos+1));
+      pos += 2;
+      addr++;
+    }
+  }
+  FlushSegment (out, segAddr, seg, segLen);
+  free (seg);
+  fclose (in);
+  if (fclose (out) != 0) {
+    perror (argv[2]);
+    exit (1);
+  }
+  return (0);
+}
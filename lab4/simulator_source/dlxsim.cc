@@ -17,873 +17,3784 @@ static char rcsid[] = "$Id: dlxsim.cc,v 1.2 2000/09/20 22:16:34 elm Exp elm $";
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <math.h>
 #include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "dlx.h"
+#include "dlxtrace.h"
+
+// A release build (-DDLXSIM_RELEASE=1) drops the debug tracing.  Every
+// load, store and jump handler has a DBPRINTF, and each one otherwise
+// costs a test of the debug flags on every instruction.
+#if DLXSIM_RELEASE
+#undef	DBPRINTF
+#define	DBPRINTF(...)	do { } while (0)
+#endif
 
 extern int errno;
 char	debug[100];
 
 //----------------------------------------------------------------------
 //
-//	Cpu::Cpu
-//
-//	Create a new CPU.
+//	Predecoded instruction cache
+//
+//	Decoding an instruction means extracting the opcode and function
+//	fields and indexing one of the instruction tables.  Since the same
+//	instructions are executed over and over, the decoded form is kept
+//	in a direct-mapped cache indexed by the instruction's physical
+//	address.  Each entry holds the instruction, its handler from the
+//	instruction tables, and the operand fields pulled out of the word
+//	once by DecodeFields: the three register numbers and the
+//	immediate in the forms the handlers use.  The handlers that are
+//	generated from tables (see DLX_ALU_INSTRS and the ones after it)
+//	have a second form that takes the entry and uses those fields
+//	directly; exec points at it, or at DecodedLegacy, which calls the
+//	table handler with the raw word, for instructions that don't have
+//	one.  Entries are invalidated whenever the word they were decoded
+//	from is written.
 //
 //----------------------------------------------------------------------
-Cpu::Cpu (int msize)
-{
-  int		i;
-  struct timeval t;
+#define	DLX_PREDECODE_BITS	14
+#define	DLX_PREDECODE_SIZE	(1 << DLX_PREDECODE_BITS)
+#define	DLX_PREDECODE_MASK	(DLX_PREDECODE_SIZE - 1)
+#define	DLX_PREDECODE_INVALID	0xffffffff	// never a word address
+
+typedef int (*InstHandler) (uint32 inst, Cpu *cpu);
+
+struct DecodedInst;
+typedef int (*DecodedHandler) (const struct DecodedInst *d, Cpu *cpu);
+
+typedef struct DecodedInst {
+  uint32	paddr;		// physical address decoded from (the tag)
+  uint32	inst;		// raw instruction word
+  InstHandler	handler;	// table handler, takes the raw word
+  DecodedHandler exec;		// handler that takes this entry
+  unsigned char	src1;		// bits 21-25: first source register
+  unsigned char	src2;		// bits 16-20: R-format source, I-format dest
+  unsigned char	dst;		// bits 11-15: R-format destination
+  uint32	imm;		// 16-bit immediate, zero extended
+  uint32	simm;		// 16-bit immediate, sign extended
+  uint32	jaddr;		// J-format offset, as from GetJFields
+} DecodedInst;
+
+static DecodedInst	predecode[DLX_PREDECODE_SIZE];
 
-  flags = 0;
-  usElapsed = 0.0;
-  instrsExecuted = 0.0;
-  usPerInst = 1.0;
-  for (i = 0; i < 32; i++) {
-    sreg[i] = 0;
-    ireg[i] = 0;
-    freg[i] = 0;
-  }
-  SetStatusBit (DLX_STATUS_PAGE_TABLE);
-  SetStatusBit (DLX_STATUS_SYSMODE);
-  EnableInterrupts ();
-  timerInterrupt = DLX_TIMER_NOT_ACTIVE;
-  memSize = msize;
-  memory = new uint32[msize/sizeof(uint32)];
-  basicBlockStart = 1;	// basic block can never start at address 1!
-  // Initialize the keyboard I/O stuff.
-  kbdbufferedchars = 0;
-  kbdrpos = kbdwpos = 0;
-  kbdcounter = 0;
-  SetupRawIo ();
-  //Zheng, add (timezone *)
-  //gettimeofday (&t, (timezone*)(void *)0);
-  gettimeofday (&t, (void *)0);
-  realElapsed = (double)t.tv_sec + ((double)t.tv_usec) * 1e-6;
-}
-
-//----------------------------------------------------------------------
-//
-//	TraceFile
-//
-//	Open the passed file name for tracing.  If the file is NULL,
-//	open stdout.
-//
-//----------------------------------------------------------------------
-int
-Cpu::TraceFile (char *name)
-{
-  if ((name == NULL) || (!strcmp (name, "-"))) {
-    tracefp = stdout;
-    return (1);
-  } else if ((tracefp = fopen (name, "w")) == NULL) {
-    return (0);
-  } else {
-    return (1);
-  }
-}
-
 //----------------------------------------------------------------------
 //
-//	Instruction parsing functions
+//	DecodeFields
 //
-//	These functions take an instruction and return the relevant fields.
+//	Fill in the operand fields of a decoded instruction.  All of
+//	them are extracted whatever the format; it's cheaper than
+//	looking the format up, and each handler only reads the ones its
+//	format has.
 //
 //----------------------------------------------------------------------
+static
 inline
 void
-Cpu::GetRFields (uint32 inst, uint32& src1, uint32& src2, uint32& dst)
+DecodeFields (DecodedInst *d, uint32 inst)
 {
-  src1 = (inst >> DLX_RFMT_SRC1_SHIFT) & DLX_REG_MASK;
-  src2 = (inst >> DLX_RFMT_SRC2_SHIFT) & DLX_REG_MASK;
-  dst = (inst >> DLX_RFMT_DST_SHIFT) & DLX_REG_MASK;
+  d->inst = inst;
+  d->src1 = (inst >> DLX_RFMT_SRC1_SHIFT) & DLX_REG_MASK;
+  d->src2 = (inst >> DLX_RFMT_SRC2_SHIFT) & DLX_REG_MASK;
+  d->dst = (inst >> DLX_RFMT_DST_SHIFT) & DLX_REG_MASK;
+  d->imm = (inst >> DLX_IFMT_IMM_SHIFT) & 0xffff;
+  d->simm = (d->imm & 0x8000) ? (d->imm | 0xffff0000) : d->imm;
+  d->jaddr = inst & 0x1ffffff;
+  if (d->jaddr & 0x1000000) {
+    d->jaddr |= 0xfe000000;
+  }
 }
 
-inline
-void
-Cpu::GetIFields (uint32 inst, uint32& src, uint32& imm, uint32& dst)
+static
+int
+DecodedLegacy (const DecodedInst *d, Cpu *cpu)
 {
-  src = (inst >> DLX_IFMT_SRC_SHIFT) & DLX_REG_MASK;
-  dst = (inst >> DLX_IFMT_DST_SHIFT) & DLX_REG_MASK;
-  imm = (inst >> DLX_IFMT_IMM_SHIFT) & 0xffff;
+  return ((d->handler) (d->inst, cpu));
 }
 
+static
 inline
-void
-Cpu::GetJFields (uint32 inst, uint32& jaddr)
+DecodedInst *
+PredecodeEntry (uint32 paddr)
 {
-  jaddr = inst & 0x1ffffff;
-  if (jaddr & 0x1000000) {
-    jaddr |= 0xfe000000;
-  }
+  return (&predecode[(paddr >> 2) & DLX_PREDECODE_MASK]);
 }
 
-inline
+static
 void
-Cpu::SignExtend16 (uint32& v)
+PredecodeFlush ()
 {
-  if (v & 0x8000) {
-    v |= 0xffff0000;
-  }
-}
+  int		i;
 
-inline
-void
-Cpu::SignExtend8 (uint32& v)
-{
-  if (v & 0x80) {
-    v |= 0xffffff00;
+  for (i = 0; i < DLX_PREDECODE_SIZE; i++) {
+    predecode[i].paddr = DLX_PREDECODE_INVALID;
   }
 }
-
+
 //----------------------------------------------------------------------
 //
-//	Cpu::Jump
+//	PredecodeInvalidate
 //
-//	Jump to a particular location after dealing with the delay
-//	slot.  Checks to ensure that the jump address could be valid
-//	(ie, is on a word boundary).  It doesn't check to ensure that
-//	the jump destination is valid; that's done on the first instruction
-//	fetch to follow.
+//	Called whenever simulated physical memory is written.  Since the
+//	cache is direct-mapped, a single word can only be cached in one
+//	slot, so a store costs just one compare.
 //
 //----------------------------------------------------------------------
+static
 inline
-int
-Cpu::Jump (uint32 jmpDst)
+void
+PredecodeInvalidate (uint32 paddr)
 {
-  if ((jmpDst & 0x3) == 0) {
-    DBPRINTF ('j', "Jump from 0x%x to 0x%x.\n", PC(), jmpDst);
-    OutputBasicBlock (jmpDst);
-    SetPC (jmpDst);
-  } else {
-    CauseException (DLX_EXC_ADDRESS);
+  DecodedInst	*d = PredecodeEntry (paddr);
+
+  if (d->paddr == (paddr & ~0x3)) {
+    d->paddr = DLX_PREDECODE_INVALID;
   }
-  return (1);
 }
 
-
-//----------------------------------------------------------------------
-//
-//	Instruction functions
-//
-//	These functions implement individual instructions.  They return
-//	the number of instructions executed, which will either be 1 if the
-//	instruction completed successfully or 0 if the instruction caused
-//	an exception.
-//
-//	Since the instructions are pretty simple (and similar), they won't
-//	be documented extensively except for the more complex ones.
-//----------------------------------------------------------------------
+static
+void
+PredecodeInvalidateRange (uint32 paddr, uint32 nbytes)
+{
+  uint32	a;
+
+  if (nbytes >= (DLX_PREDECODE_SIZE << 2)) {
+    PredecodeFlush ();
+    return;
+  }
+  for (a = paddr & ~0x3; a < paddr + nbytes; a += 4) {
+    PredecodeInvalidate (a);
+  }
+}
 
 //----------------------------------------------------------------------
 //
-//	Generic ALU R-R instructions
+//	Translation cache
+//
+//	Walking the page table means several reads of simulated memory
+//	for every load, store and instruction fetch.  Completed walks are
+//	remembered in a small direct-mapped cache keyed by (page table
+//	base, virtual page).  Only translations that succeeded are cached,
+//	so faults are always raised by a real walk.  Each entry remembers
+//	the address of the L1 entry and of the leaf PTE it was built from;
+//	those words are marked in xlatePteWords so that a store to either
+//	of them drops the entry.  Changing the page table geometry
+//	(DLX_SREG_PGTBL_BITS or _SIZE) flushes the whole cache; changing
+//	the base doesn't need to, since the base is part of the key.
+//
+//	The cached PTE is also what decides whether the referenced and
+//	dirty bits need setting: the PTE is only written back when one of
+//	them is actually turned on, so a page that's already referenced
+//	(and, for stores, dirty) costs no store to the page table.  If
+//	DLXSIM_PTE_AD is "off", the bits are never set at all, for OS
+//	versions that don't look at them.
+//
+//	With a two-level table, an L1 entry with DLX_PTE_SUPERPAGE set is
+//	a leaf that maps the whole L1 region (1 << L1 bits bytes) at once,
+//	so the walk stops there.  The physical base in a superpage entry
+//	must be aligned to the region size.  The high bit is used because
+//	ordinary L1 entries are L2 table addresses, which are only word
+//	aligned.  Superpages are cached per page like any other mapping;
+//	their leaf PTE is the L1 entry itself.
 //
 //----------------------------------------------------------------------
+#ifndef	DLX_PTE_SUPERPAGE
+#define	DLX_PTE_SUPERPAGE	0x80000000
+#endif
+
+#define	DLX_XLATE_BITS		8
+#define	DLX_XLATE_SIZE		(1 << DLX_XLATE_BITS)
+#define	DLX_XLATE_MASK		(DLX_XLATE_SIZE - 1)
+
+typedef struct XlateEntry {
+  int		valid;
+  uint32	base;		// DLX_SREG_PGTBL_BASE used for the walk
+  uint32	vpage;		// virtual address with page offset masked
+  uint32	l1addr;		// physical address of the L1 entry
+  uint32	pteaddr;	// physical address of the leaf PTE
+  uint32	pte;		// copy of the leaf PTE
+} XlateEntry;
+
+static XlateEntry	xlate[DLX_XLATE_SIZE];
+static unsigned char	*xlatePteWords;	// 1 bit per word of memory
+static uint32		xlatePteWordsSize;
+static uint32		xlateAdMask = DLX_PTE_DIRTY | DLX_PTE_REFERENCED;
+
 static
-int
-InstAdd (uint32 inst, Cpu *cpu)
+inline
+XlateEntry *
+XlateLookup (uint32 base, uint32 vpage, uint32 pagebits)
 {
-  uint32	src1, src2, dst;
-  uint32	v1, v2, result;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  v1 = cpu->GetIreg(src1);
-  v2 = cpu->GetIreg(src2);
-  result = v1 + v2;
-  cpu->PutIreg (dst, result);
-  // Overflow if sign of result isn't the same as sign of operands
-  if (((v1 & 0x80000000) == (v2 & 0x80000000)) &&
-      ((v1 & 0x80000000) != (result & 0x80000000))) {
-    cpu->CauseException (DLX_EXC_OVERFLOW);
-  }
-  // Instruction isn't redone after exception
-  return (1);
+  return (&xlate[((vpage >> pagebits) ^ (base >> 2)) & DLX_XLATE_MASK]);
 }
 
 static
-int
-InstSub (uint32 inst, Cpu *cpu)
+void
+XlateFlush ()
 {
-  uint32	src1, src2, dst;
-  uint32	v1, v2, result;
+  int		i;
 
-  cpu->GetRFields (inst, src1, src2, dst);
-  v1 = cpu->GetIreg(src1);
-  v2 = cpu->GetIreg(src2);
-  result = v1 - v2;
-  cpu->PutIreg (dst, result);
-  // Overflow if sign of result isn't the same as sign of first operand,
-  // and if second operand has the opposite sign.
-  if (((v1 & 0x80000000) != (v2 & 0x80000000)) &&
-      ((v1 & 0x80000000) != (result & 0x80000000))) {
-    cpu->CauseException (DLX_EXC_OVERFLOW);
+  for (i = 0; i < DLX_XLATE_SIZE; i++) {
+    xlate[i].valid = 0;
+  }
+  if (xlatePteWords != NULL) {
+    memset (xlatePteWords, 0, xlatePteWordsSize);
   }
-  // Instruction isn't redone after exception
-  return (1);
 }
 
 static
+inline
 int
-InstAddu (uint32 inst, Cpu *cpu)
+XlateIsPteWord (uint32 paddr)
 {
-  uint32	src1, src2, dst;
-  uint32	v1, v2, result;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  v1 = cpu->GetIreg(src1);
-  v2 = cpu->GetIreg(src2);
-  result = v1 + v2;
-  cpu->PutIreg (dst, result);
-  return (1);
+  paddr >>= 2;
+  return (((paddr >> 3) < xlatePteWordsSize) &&
+	  (xlatePteWords[paddr >> 3] & (1 << (paddr & 0x7))));
 }
 
 static
-int
-InstSubu (uint32 inst, Cpu *cpu)
+inline
+void
+XlateMarkPteWord (uint32 paddr)
 {
-  uint32	src1, src2, dst;
-  uint32	v1, v2, result;
+  paddr >>= 2;
+  xlatePteWords[paddr >> 3] |= (1 << (paddr & 0x7));
+}
 
-  cpu->GetRFields (inst, src1, src2, dst);
-  v1 = cpu->GetIreg(src1);
-  v2 = cpu->GetIreg(src2);
-  result = v1 - v2;
-  cpu->PutIreg (dst, result);
-  return (1);
+static
+void
+XlateFill (XlateEntry *e, uint32 base, uint32 vpage, uint32 l1addr,
+	   uint32 pteaddr, uint32 pte)
+{
+  // Can't watch PTEs that live outside of memory, so don't cache them.
+  if (((l1addr >> 5) >= xlatePteWordsSize) ||
+      ((pteaddr >> 5) >= xlatePteWordsSize)) {
+    return;
+  }
+  e->valid = 1;
+  e->base = base;
+  e->vpage = vpage;
+  e->l1addr = l1addr;
+  e->pteaddr = pteaddr;
+  e->pte = pte;
+  XlateMarkPteWord (l1addr);
+  XlateMarkPteWord (pteaddr);
 }
-
+
 //----------------------------------------------------------------------
 //
-//	Immediate arithmetic functions
+//	XlateInvalidate
+//
+//	Called whenever a word of simulated physical memory is written.
+//	The common case (the word isn't a cached PTE) is a single bit test.
 //
 //----------------------------------------------------------------------
 static
-int
-InstAddi (uint32 inst, Cpu *cpu)
+inline
+void
+XlateInvalidate (uint32 paddr)
 {
-  uint32	src1, dst, imm;
-  uint32	v1, result;
+  int		i;
 
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  v1 = cpu->GetIreg(src1);
-  result = v1 + imm;
-  cpu->PutIreg (dst, result);
-  // Overflow if sign of result isn't the same as sign of operands
-  if (((v1 & 0x80000000) == (imm & 0x80000000)) &&
-      ((v1 & 0x80000000) != (result & 0x80000000))) {
-    cpu->CauseException (DLX_EXC_OVERFLOW);
+  paddr &= ~0x3;
+  if (! XlateIsPteWord (paddr)) {
+    return;
   }
-  // Instruction isn't redone after exception
-  return (1);
-}
-
-static
-int
-InstSubi (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, dst, imm;
-  uint32	v1, result;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  v1 = cpu->GetIreg(src1);
-  result = v1 - imm;
-  cpu->PutIreg (dst, result);
-  // Overflow if sign of result isn't the same as sign of first operand,
-  // and if second operand has the opposite sign.
-  if (((v1 & 0x80000000) != (imm & 0x80000000)) &&
-      ((v1 & 0x80000000) != (result & 0x80000000))) {
-    cpu->CauseException (DLX_EXC_OVERFLOW);
+  for (i = 0; i < DLX_XLATE_SIZE; i++) {
+    if (xlate[i].valid &&
+	((xlate[i].l1addr == paddr) || (xlate[i].pteaddr == paddr))) {
+      xlate[i].valid = 0;
+    }
   }
-  // Instruction isn't redone after exception
-  return (1);
+  paddr >>= 2;
+  xlatePteWords[paddr >> 3] &= ~(1 << (paddr & 0x7));
 }
 
 static
-int
-InstAddui (uint32 inst, Cpu *cpu)
+void
+XlateInvalidateRange (uint32 paddr, uint32 nbytes)
 {
-  uint32	src1, imm, dst;
-  uint32	v1, result;
+  uint32	a;
 
-  cpu->GetIFields (inst, src1, imm, dst);
-  // XXX: do we sign extend values for addui?
-  // cpu->SignExtend16 (imm);
-  v1 = cpu->GetIreg(src1);
-  result = v1 + imm;
-  cpu->PutIreg (dst, result);
-  return (1);
+  for (a = paddr & ~0x3; a < paddr + nbytes; a += 4) {
+    if (XlateIsPteWord (a)) {
+      XlateFlush ();
+      return;
+    }
+  }
 }
 
-static
-int
-InstSubui (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, imm, dst;
-  uint32	v1, result;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  // XXX: do we sign extend values for subui?
-  // cpu->SignExtend16 (imm);
-  v1 = cpu->GetIreg(src1);
-  result = v1 - imm;
-  cpu->PutIreg (dst, result);
-  return (1);
-}
-
 //----------------------------------------------------------------------
 //
-//	R-R logical functions
+//	Software-loaded TLB
+//
+//	Used instead of the page table when DLX_STATUS_TLB is set.  The
+//	OS loads entries through a set of I/O registers; a reference that
+//	misses loads the faulting address into DLX_SREG_FAULT_ADDR and
+//	raises DLX_EXC_TLBFAULT, so the OS can refill the entry and
+//	restart the instruction.  Entries hold a virtual page and a PTE in
+//	the usual page table format, and are tagged with the value of
+//	DLX_SREG_PGTBL_BASE at the time they were written so that
+//	processes don't see each other's entries.  The page size is taken
+//	from the low half of DLX_SREG_PGTBL_BITS, as for page tables.
+//
+//	Registers:
+//	DLX_TLB_INDEX	  entry used by DLX_TLB_WRITE and DLX_TLB_READ
+//	DLX_TLB_ENTRYHI	  virtual page of the entry
+//	DLX_TLB_ENTRYLO	  PTE of the entry
+//	DLX_TLB_WRITE	  (write) store ENTRYHI/ENTRYLO at INDEX
+//	DLX_TLB_REPLACE	  (write) store ENTRYHI/ENTRYLO in the next
+//			  entry in round-robin order
+//	DLX_TLB_READ	  (write) load ENTRYHI/ENTRYLO from INDEX
+//	DLX_TLB_PROBE	  (write) set INDEX to the entry matching the
+//			  address written, or 0xffffffff if none does
+//	DLX_TLB_FLUSH	  (write) invalidate every entry
+//	DLX_TLB_NENTRIES  (read) number of entries
+//
+//	The number of entries is DLX_SWTLB_ENTRIES unless DLXSIM_SWTLB_ENTRIES
+//	is set in the environment.  Checkpoints record the count, and a
+//	restored run uses the count it was saved with.
 //
 //----------------------------------------------------------------------
+#ifndef	DLX_SWTLB_ENTRIES
+#define	DLX_SWTLB_ENTRIES	32
+#endif
+#ifndef	DLX_EXC_TLBFAULT
+#define	DLX_EXC_TLBFAULT	0x30
+#endif
+
+#define	DLX_TLB_INDEX		0xfff00400
+#define	DLX_TLB_ENTRYHI		0xfff00404
+#define	DLX_TLB_ENTRYLO		0xfff00408
+#define	DLX_TLB_WRITE		0xfff0040c
+#define	DLX_TLB_REPLACE		0xfff00410
+#define	DLX_TLB_READ		0xfff00414
+#define	DLX_TLB_PROBE		0xfff00418
+#define	DLX_TLB_FLUSH		0xfff0041c
+#define	DLX_TLB_NENTRIES	0xfff00420
+
+#define	DLX_TLB_NO_ENTRY	0xffffffff
+
+typedef struct SwTlbEntry {
+  int		valid;
+  uint32	asid;		// DLX_SREG_PGTBL_BASE when loaded
+  uint32	vpage;		// virtual address with page offset masked
+  uint32	pte;		// page table entry for the page
+} SwTlbEntry;
+
+static SwTlbEntry	*swtlb;
+static uint32		swtlbEntries;
+static uint32		swtlbIndex, swtlbHi, swtlbLo;
+static uint32		swtlbNext;	// next entry for DLX_TLB_REPLACE
+static uint32		swtlbLastHit;	// entry SwTlbFind found last
+static double		swtlbMisses;
 
 static
-int
-InstAnd (uint32 inst, Cpu *cpu)
+void
+SwTlbFlush ()
 {
-  uint32	src1, src2, dst;
+  uint32	i;
 
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, cpu->GetIreg(src1) & cpu->GetIreg(src2));
-  return (1);
+  for (i = 0; i < swtlbEntries; i++) {
+    swtlb[i].valid = 0;
+  }
 }
 
 static
-int
-InstOr (uint32 inst, Cpu *cpu)
+void
+SwTlbResize (uint32 n)
 {
-  uint32	src1, src2, dst;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, cpu->GetIreg(src1) | cpu->GetIreg(src2));
-  return (1);
+  delete [] swtlb;
+  swtlbEntries = n;
+  swtlb = new SwTlbEntry[n];
+  swtlbIndex = swtlbNext = swtlbLastHit = 0;
+  SwTlbFlush ();
 }
 
 static
-int
-InstXor (uint32 inst, Cpu *cpu)
+void
+SwTlbInit ()
 {
-  uint32	src1, src2, dst;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, cpu->GetIreg(src1) ^ cpu->GetIreg(src2));
-  return (1);
+  const char	*env = getenv ("DLXSIM_SWTLB_ENTRIES");
+  uint32	n = DLX_SWTLB_ENTRIES;
+
+  if (env != NULL) {
+    if ((n = strtoul (env, NULL, 10)) == 0) {
+      fprintf (stderr, "Bad DLXSIM_SWTLB_ENTRIES %s, using %d.\n", env,
+	       DLX_SWTLB_ENTRIES);
+      n = DLX_SWTLB_ENTRIES;
+    }
+  }
+  SwTlbResize (n);
 }
 
 static
-int
-InstSll (uint32 inst, Cpu *cpu)
+inline
+uint32
+SwTlbPageMask (Cpu *cpu)
 {
-  uint32	src1, src2, dst;
-  uint32	v1, v2;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  v1 = cpu->GetIreg(src1);
-  v2 = cpu->GetIreg(src2) & 0x1f;
-  cpu->PutIreg (dst, v1 << v2);
-  return (1);
+  return ((1 << (cpu->GetSreg (DLX_SREG_PGTBL_BITS) & 0xffff)) - 1);
 }
 
 static
 int
-InstSra (uint32 inst, Cpu *cpu)
+SwTlbFind (Cpu *cpu, uint32 vaddr)
 {
-  uint32	src1, src2, dst;
-  uint32	v1, v2, result;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  v1 = cpu->GetIreg(src1);
-  v2 = cpu->GetIreg(src2) & 0x1f;
-  result = v1 >> v2;
-  // stick in sign bits if operand is negative
-  if (v1 & 0x80000000) {
-    result |= ((1 << v2) - 1) << (32 - v2);
+  uint32	vpage, asid;
+  uint32	i;
+
+  vpage = vaddr & ~SwTlbPageMask (cpu);
+  asid = cpu->GetSreg (DLX_SREG_PGTBL_BASE);
+  // Most references hit the same entry as the previous one.
+  i = swtlbLastHit;
+  if (swtlb[i].valid && (swtlb[i].vpage == vpage) && (swtlb[i].asid == asid)) {
+    return (i);
   }
-  cpu->PutIreg (dst, result);
-  return (1);
+  for (i = 0; i < swtlbEntries; i++) {
+    if (swtlb[i].valid && (swtlb[i].vpage == vpage) &&
+	(swtlb[i].asid == asid)) {
+      swtlbLastHit = i;
+      return (i);
+    }
+  }
+  return (-1);
 }
 
 static
-int
-InstSrl (uint32 inst, Cpu *cpu)
+void
+SwTlbLoad (Cpu *cpu, uint32 index)
 {
-  uint32	src1, src2, dst;
-  uint32	v1, v2;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  v1 = cpu->GetIreg(src1);
-  v2 = cpu->GetIreg(src2) & 0x1f;
-  cpu->PutIreg (dst, v1 >> v2);
-  return (1);
+  if (index >= swtlbEntries) {
+    cpu->CauseException (DLX_EXC_ACCESS);
+    return;
+  }
+  DBPRINTF ('m', "TLB entry %d <= 0x%x -> 0x%x\n", index, swtlbHi, swtlbLo);
+  swtlb[index].valid = 1;
+  swtlb[index].asid = cpu->GetSreg (DLX_SREG_PGTBL_BASE);
+  swtlb[index].vpage = swtlbHi & ~SwTlbPageMask (cpu);
+  swtlb[index].pte = swtlbLo;
 }
-
+
 //----------------------------------------------------------------------
 //
-//	Immediate logical functions
+//	SwTlbTranslate
+//
+//	Translate an address using the software TLB.  Exceptions are the
+//	same as for page tables except that a missing entry causes a
+//	DLX_EXC_TLBFAULT instead of a walk.  The referenced and dirty
+//	bits are kept in the TLB entry, where the OS can read them back.
 //
 //----------------------------------------------------------------------
 static
 int
-InstAndi (uint32 inst, Cpu *cpu)
+SwTlbTranslate (Cpu *cpu, uint32 vaddr, uint32& paddr, uint32 op,
+		uint32 pteflags)
 {
-  uint32	src1, imm, dst;
+  int		i;
+  uint32	pagemask;
 
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->PutIreg (dst, cpu->GetIreg(src1) & imm);
+  if ((i = SwTlbFind (cpu, vaddr)) < 0) {
+    DBPRINTF ('m', "TLB miss on 0x%x\n", vaddr);
+    swtlbMisses += 1.0;
+    cpu->PutSreg (DLX_SREG_FAULT_ADDR, vaddr);
+    cpu->CauseException (DLX_EXC_TLBFAULT);
+    return (0);
+  }
+  if (!(swtlb[i].pte & DLX_PTE_VALID)) {
+    DBPRINTF ('m', "TLB entry %d invalid (0x%08x)\n", i, swtlb[i].pte);
+    cpu->PutSreg (DLX_SREG_FAULT_ADDR, vaddr);
+    cpu->CauseException (DLX_EXC_PAGEFAULT);
+    return (0);
+  }
+#if USE_ROP
+  if ((op == DLX_MEM_WRITE) && (swtlb[i].pte & DLX_PTE_RW)) {
+    cpu->PutSreg (DLX_SREG_FAULT_ADDR, vaddr);
+    cpu->CauseException(DLX_ROP_ACCESS);
+    return (0);
+  }
+  swtlb[i].pte |= pteflags & xlateAdMask & DLX_PTE_DIRTY;
+#else
+  swtlb[i].pte |= pteflags & xlateAdMask;
+#endif
+  pagemask = SwTlbPageMask (cpu);
+  paddr = (swtlb[i].pte & ~(pagemask | DLX_PTE_MASK)) | (vaddr & pagemask);
+  DBPRINTF ('m', "0x%x => 0x%x using TLB entry %d\n", vaddr, paddr, i);
   return (1);
 }
 
+//----------------------------------------------------------------------
+//
+//	Translated basic blocks
+//
+//	When enabled (by setting DLXSIM_BLOCKS in the environment), ExecOne
+//	runs a whole basic block per call rather than a single instruction.
+//	A block is translated once into an array of decoded instructions
+//	(see DecodedInst) and cached by the physical address of its first instruction.
+//	It ends after the first control transfer (jump, branch, trap, rfe)
+//	or movi2s, since those can change the PC or the translation mode,
+//	and never crosses a DLX_BLOCK_CHUNK-byte boundary so that it lies in
+//	a single page as long as pages are at least that big.
+//
+//	A block also ends early when the next instruction reaches the
+//	earliest event deadline (nextEvent), so timer, keyboard and disk
+//	events are seen at the same instruction count as without blocks.
+//	The PC is still advanced before each instruction, so an exception
+//	(or a jump) stops the block with the IAR pointing at the right
+//	instruction.
+//	Writes into a chunk that holds translated code drop every block
+//	that starts in that chunk.
+//
+//----------------------------------------------------------------------
+#define	DLX_BLOCK_MAX_INSTRS	32
+#define	DLX_BLOCK_CHUNK_BITS	10
+#define	DLX_BLOCK_CHUNK		(1 << DLX_BLOCK_CHUNK_BITS)
+#define	DLX_BLOCK_CACHE_BITS	12
+#define	DLX_BLOCK_CACHE_SIZE	(1 << DLX_BLOCK_CACHE_BITS)
+#define	DLX_BLOCK_CACHE_MASK	(DLX_BLOCK_CACHE_SIZE - 1)
+#define	DLX_BLOCK_INVALID	0xffffffff
+
+typedef struct TranslatedBlock {
+  uint32	paddr;		// physical address of first instruction
+  int		ninstrs;
+  DecodedInst	code[DLX_BLOCK_MAX_INSTRS];
+} TranslatedBlock;
+
+static int		blockExec;	// run translated blocks?
+static TranslatedBlock	*blocks;
+static unsigned char	*blockChunks;	// 1 bit per chunk holding code
+static uint32		blockChunksSize;
+
 static
-int
-InstOri (uint32 inst, Cpu *cpu)
+void
+BlockFlush ()
 {
-  uint32	src1, imm, dst;
+  int		i;
 
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->PutIreg (dst, cpu->GetIreg(src1) | imm);
-  return (1);
+  if (blocks == NULL) {
+    return;
+  }
+  for (i = 0; i < DLX_BLOCK_CACHE_SIZE; i++) {
+    blocks[i].paddr = DLX_BLOCK_INVALID;
+  }
+  memset (blockChunks, 0, blockChunksSize);
 }
 
 static
-int
-InstXori (uint32 inst, Cpu *cpu)
+void
+BlockInit (uint32 msize)
 {
-  uint32	src1, imm, dst;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->PutIreg (dst, cpu->GetIreg(src1) ^ imm);
-  return (1);
+  blockExec = (getenv ("DLXSIM_BLOCKS") != NULL);
+  if (! blockExec) {
+    return;
+  }
+  blocks = new TranslatedBlock[DLX_BLOCK_CACHE_SIZE];
+  blockChunksSize = ((msize >> DLX_BLOCK_CHUNK_BITS) + 8) / 8;
+  blockChunks = new unsigned char[blockChunksSize];
+  BlockFlush ();
 }
 
 static
-int
-InstSlli (uint32 inst, Cpu *cpu)
+inline
+TranslatedBlock *
+BlockLookup (uint32 paddr)
 {
-  uint32	src1, imm, dst;
-  uint32	v1;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  v1 = cpu->GetIreg(src1);
-  imm &= 0x1f;
-  cpu->PutIreg (dst, v1 << imm);
-  return (1);
+  return (&blocks[(paddr >> 2) & DLX_BLOCK_CACHE_MASK]);
 }
 
 static
-int
-InstSrai (uint32 inst, Cpu *cpu)
+inline
+void
+BlockMarkChunk (uint32 paddr)
 {
-  uint32	src1, imm, dst;
-  uint32	v1, result;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  v1 = cpu->GetIreg(src1);
-  imm &= 0x1f;
-  result = v1 >> imm;
-  // stick in sign bits if operand is negative
-  if (v1 & 0x80000000) {
-    result |= ((1 << imm) - 1) << (32 - imm);
-  }
-  cpu->PutIreg (dst, result);
-  return (1);
+  paddr >>= DLX_BLOCK_CHUNK_BITS;
+  blockChunks[paddr >> 3] |= (1 << (paddr & 0x7));
 }
 
+//----------------------------------------------------------------------
+//
+//	BlockInvalidate
+//
+//	Drop all blocks starting in the chunk holding paddr.  Because the
+//	cache index is taken from the low address bits, those blocks can
+//	only be in one run of DLX_BLOCK_CHUNK/4 consecutive slots.
+//
+//----------------------------------------------------------------------
 static
-int
-InstSrli (uint32 inst, Cpu *cpu)
+inline
+void
+BlockInvalidate (uint32 paddr)
 {
-  uint32	src1, imm, dst;
-  uint32	v1;
+  uint32	chunk, first, i;
 
-  cpu->GetIFields (inst, src1, imm, dst);
-  v1 = cpu->GetIreg(src1);
-  imm &= 0x1f;
-  cpu->PutIreg (dst, v1 >> imm);
-  return (1);
+  if (blocks == NULL) {
+    return;
+  }
+  chunk = paddr >> DLX_BLOCK_CHUNK_BITS;
+  if (((chunk >> 3) >= blockChunksSize) ||
+      !(blockChunks[chunk >> 3] & (1 << (chunk & 0x7)))) {
+    return;
+  }
+  first = chunk << DLX_BLOCK_CHUNK_BITS;
+  for (i = 0; i < DLX_BLOCK_CHUNK; i += 4) {
+    if ((BlockLookup (first + i)->paddr >> DLX_BLOCK_CHUNK_BITS) == chunk) {
+      BlockLookup (first + i)->paddr = DLX_BLOCK_INVALID;
+    }
+  }
+  blockChunks[chunk >> 3] &= ~(1 << (chunk & 0x7));
 }
 
+//----------------------------------------------------------------------
+//
+//	BlockEnds
+//
+//	Return true if the instruction must be the last one in a block.
+//
+//----------------------------------------------------------------------
 static
 int
-InstLhi (uint32 inst, Cpu *cpu)
+BlockEnds (uint32 inst)
 {
-  uint32	src, dst, imm;
+  uint32	op = (inst >> DLX_OPCODE_SHIFT) & DLX_OPCODE_MASK;
 
-  cpu->GetIFields (inst, src, imm, dst);
-  cpu->PutIreg (dst, imm << 16);
-  return (1);
+  if ((op >= 0x02) && (op <= 0x07)) {	// jumps and branches
+    return (1);
+  } else if ((op >= 0x10) && (op <= 0x13)) {	// rfe, trap, jr, jalr
+    return (1);
+  } else if ((op == 0x00) &&
+	     (((inst >> DLX_ALU_FUNC_CODE_SHIFT) & DLX_ALU_FUNC_CODE_MASK)
+	      == 0x30)) {			// movi2s
+    return (1);
+  }
+  return (0);
 }
-
+
 //----------------------------------------------------------------------
 //
-//	R-R set instructions
+//	Event deadlines
+//
+//	Rather than checking every device on every instruction, ExecOne
+//	counts instructions in an integer and only looks at the devices
+//	when the count reaches the earliest pending deadline.  eventAt[]
+//	holds, for each device, the instruction count at which it next
+//	needs attention; nextEvent is the smallest of them.
+//
+//	The simulated clock (usElapsed) and instrsExecuted are brought up
+//	to date from the counter with SYNC_SIM_TIME before anything looks
+//	at them.  The timer deadline is computed conservatively (never
+//	late), and the exact floating point comparison is still done when
+//	it's reached, so interrupts happen on the same instruction they
+//	always did.
 //
 //----------------------------------------------------------------------
-static
-int
-InstSeq (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
+#define	DLX_EVENT_KBD		0
+#define	DLX_EVENT_TIMER		1
+#define	DLX_EVENT_CKPT		2
+#define	DLX_EVENT_PROFILE	3
+#define	DLX_EVENT_DISK		4
+#define	DLX_EVENT_HEATMAP	5
+#define	DLX_EVENT_CONSOLE	6
+#define	DLX_EVENT_IPI		7
+#define	DLX_EVENT_MAX		8
+
+#define	DLX_EVENT_NEVER		0x7fffffffffffffffLL
+
+// Never wait longer than this between checks, so that huge (inactive)
+// timer values don't overflow the counters.
+#define	DLX_EVENT_MAX_WAIT	1000000000LL
+
+static long long	simInstrs;	// instructions executed + stall cycles
+static long long	syncedInstrs;	// simInstrs at last SYNC_SIM_TIME
+static long long	stallCycles;	// cache and disk stalls, in instr times
+static long long	diskStallCycles; // disk part of stallCycles
+static long long	syncedStalls;	// stallCycles at last SYNC_SIM_TIME
+static long long	eventAt[DLX_EVENT_MAX];
+static long long	nextEvent;
+
+// The OS idle loop calls this trap to say it's waiting for an interrupt.
+// The next event check then moves the clock forward to the timer
+// deadline rather than simulating the wait instruction by instruction.
+#define	DLX_TRAP_IDLE		0x2100
+
+static int		idleRequested;
+static double		idleUsSkipped;	// simulated time fast-forwarded
 
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, (cpu->GetIreg(src1) == cpu->GetIreg(src2)) ? 1 : 0);
-  return (1);
-}
+//----------------------------------------------------------------------
+//
+//	Multiprocessors
+//
+//	Setting DLXSIM_CPUS=n (up to DLX_MP_MAX_CPUS) gives the machine n
+//	processors sharing one physical memory.  The Cpu that main creates
+//	is CPU 0 and boots the OS as usual; the others wait until a
+//	running CPU starts them through these I/O registers:
+//
+//	DLX_MP_NCPUS	  (read) number of CPUs
+//	DLX_MP_START_PC	  address a started CPU begins executing at
+//	DLX_MP_START	  (write) start the CPU with the number written
+//	DLX_MP_IPI	  (write) interrupt the CPU with the number written
+//
+//	A started CPU is a copy of the one that started it, so it shares
+//	its memory, open host files and interrupt vector; it begins at
+//	DLX_MP_START_PC in system mode with interrupts off, zeroed integer
+//	registers, no timer and an empty software TLB.  DLX_SREG_CPUID
+//	holds each CPU's number, and is the value a kernel should use to
+//	index per-CPU data.  An inter-processor interrupt raises
+//	DLX_EXC_IPI on the target once its interrupts are enabled.
+//
+//	CPU 0's ExecOne runs one instruction on every other started CPU
+//	before its own, so the CPUs advance in lockstep and simInstrs
+//	(the clock) counts rounds.  Each CPU has its own registers, timer,
+//	software TLB and ll reservation (mpCur is the CPU executing now,
+//	and MpSwitch swaps the TLB in).  Everything else is the machine's:
+//	the keyboard, disk and checkpoint events and their interrupts all
+//	belong to CPU 0, as do the statistics, and the caches are modelled
+//	as one cache that every CPU uses.  Translated blocks are turned
+//	off, checkpoints fail once a second CPU has started, and the idle
+//	trap only skips time while CPU 0 is the only one running.
+//
+//	ll (opcode 0x30) loads a word and reserves its address; sc (opcode
+//	0x38) stores a register there only if the reservation still holds,
+//	and sets the register to 1 if it did or 0 if it didn't.  Any
+//	exception or rfe drops the CPU's reservation, so a sequence
+//	interrupted by a context switch fails and is retried, and any
+//	write to the reserved word (a store from any CPU, DMA, a bulk
+//	operation or a host file read) drops every reservation on it.
+//	That makes ll/sc safe for locks without disabling interrupts, and
+//	between CPUs.
+//
+//----------------------------------------------------------------------
+#ifndef	DLX_SREG_CPUID
+#define	DLX_SREG_CPUID		31
+#endif
+#ifndef	DLX_EXC_IPI
+#define	DLX_EXC_IPI		0x58
+#endif
+
+#define	DLX_MP_NCPUS		0xfff00600
+#define	DLX_MP_START_PC		0xfff00604
+#define	DLX_MP_START		0xfff00608
+#define	DLX_MP_IPI		0xfff0060c
+
+#define	DLX_MP_MAX_CPUS		16
+
+typedef struct MpCpu {
+  Cpu		*cpu;		// NULL until started (except CPU 0)
+  int		running;
+  int		ipiPending;
+  double	instrs;		// instructions run, for secondary CPUs
+  int		llValid;
+  uint32	llAddr;		// virtual address reserved by ll
+  uint32	llSpace;	// DLX_SREG_PGTBL_BASE at the ll
+  uint32	llPaddr;	// physical address reserved by ll
+  // Software TLB state while another CPU is running.
+  SwTlbEntry	*swtlb;
+  uint32	swtlbIndex, swtlbHi, swtlbLo, swtlbNext, swtlbLastHit;
+} MpCpu;
+
+static MpCpu		mpCpus[DLX_MP_MAX_CPUS];
+static MpCpu		*mpCur = &mpCpus[0];
+static int		mpCount = 1;
+static int		mpRunning;	// started CPUs other than CPU 0
+static uint32		mpStartPc;
+static int		llAny;		// some reservation may be valid
 
 static
-int
-InstSne (uint32 inst, Cpu *cpu)
+void
+MpInit (Cpu *boot)
 {
-  uint32	src1, src2, dst;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, (cpu->GetIreg(src1) != cpu->GetIreg(src2)) ? 1 : 0);
-  return (1);
+  const char	*s = getenv ("DLXSIM_CPUS");
+
+  mpCpus[0].cpu = boot;
+  mpCpus[0].running = 1;
+  eventAt[DLX_EVENT_IPI] = DLX_EVENT_NEVER;
+  if (s != NULL) {
+    mpCount = atoi (s);
+    if ((mpCount < 1) || (mpCount > DLX_MP_MAX_CPUS)) {
+      fprintf (stderr, "DLXSIM_CPUS must be 1 to %d.\n", DLX_MP_MAX_CPUS);
+      mpCount = 1;
+    }
+  }
 }
 
+//----------------------------------------------------------------------
+//
+//	MpSwitch
+//
+//	Make another CPU the current one, swapping in its software TLB.
+//
+//----------------------------------------------------------------------
 static
-int
-InstSlt (uint32 inst, Cpu *cpu)
+void
+MpSwitch (MpCpu *to)
 {
-  uint32	src1, src2, dst;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) < (int)cpu->GetIreg(src2))
-		? 1 : 0);
-  return (1);
+  if (to == mpCur) {
+    return;
+  }
+  mpCur->swtlb = swtlb;
+  mpCur->swtlbIndex = swtlbIndex;
+  mpCur->swtlbHi = swtlbHi;
+  mpCur->swtlbLo = swtlbLo;
+  mpCur->swtlbNext = swtlbNext;
+  mpCur->swtlbLastHit = swtlbLastHit;
+  mpCur = to;
+  swtlb = to->swtlb;
+  swtlbIndex = to->swtlbIndex;
+  swtlbHi = to->swtlbHi;
+  swtlbLo = to->swtlbLo;
+  swtlbNext = to->swtlbNext;
+  swtlbLastHit = to->swtlbLastHit;
 }
-static
-int
-InstSgt (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
 
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) > (int)cpu->GetIreg(src2))
-		? 1 : 0);
-  return (1);
-}
+//----------------------------------------------------------------------
+//
+//	LlBreak
+//
+//	Drop every reservation on a word in [paddr, paddr+nbytes).  Called
+//	through MemoryWritten and MemoryRangeWritten only while llAny is
+//	set; llAny is cleared here once no reservation is left.
+//
+//----------------------------------------------------------------------
 static
-int
-InstSle (uint32 inst, Cpu *cpu)
+void
+LlBreak (uint32 paddr, uint32 nbytes)
 {
-  uint32	src1, src2, dst;
+  int		i;
 
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) <= (int)cpu->GetIreg(src2))
-		? 1 : 0);
-  return (1);
+  llAny = 0;
+  for (i = 0; i < mpCount; i++) {
+    if (mpCpus[i].llValid && (mpCpus[i].llPaddr >= (paddr & ~0x3)) &&
+	(mpCpus[i].llPaddr < paddr + nbytes)) {
+      DBPRINTF ('s', "CPU %d loses its reservation at 0x%x\n", i,
+		mpCpus[i].llPaddr);
+      mpCpus[i].llValid = 0;
+    }
+    llAny |= mpCpus[i].llValid;
+  }
 }
-static
-int
-InstSge (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
 
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) >= (int)cpu->GetIreg(src2))
-		? 1 : 0);
-  return (1);
-}
-
 //----------------------------------------------------------------------
 //
-//	Immediate set instructions
+//	Performance counters
+//
+//	Special registers DLX_SREG_PERF_INSTRS_LO through DLX_SREG_PERF_EXC
+//	hold counters the OS can read with movs2i: instructions retired
+//	and simulated microseconds (64 bits each, as two registers), page
+//	table walks, and word loads and stores (including I/O accesses).
+//	Exceptions are counted by cause; write the cause to
+//	DLX_SREG_PERF_EXCSEL, then read DLX_SREG_PERF_EXC.  Traps are all
+//	counted under DLX_PERF_EXC_TRAPS.  Writes to the other counters
+//	are ignored.
+//
+//	User programs (which can't use movs2i) read the same counters with
+//	DLX_TRAP_PERFCOUNTER, which takes the counter in r1 and returns its
+//	value there.  The counter is a register number, or DLX_PERF_EXC
+//	plus a cause to read the exception counts directly.  The argument
+//	is in a register rather than on the stack so that the trap works
+//	the same in user mode, where the stack address is virtual.
 //
 //----------------------------------------------------------------------
+#define	DLX_SREG_PERF_INSTRS_LO	16
+#define	DLX_SREG_PERF_INSTRS_HI	17
+#define	DLX_SREG_PERF_US_LO	18
+#define	DLX_SREG_PERF_US_HI	19
+#define	DLX_SREG_PERF_WALKS	20
+#define	DLX_SREG_PERF_LOADS	21
+#define	DLX_SREG_PERF_STORES	22
+#define	DLX_SREG_PERF_EXCSEL	23
+#define	DLX_SREG_PERF_EXC	24
+
+#define	DLX_TRAP_PERFCOUNTER	0x2104
+
+#define	DLX_PERF_EXC		0x100
+#define	DLX_PERF_EXC_CAUSES	0x80
+#define	DLX_PERF_EXC_TRAPS	0x7f	// traps (and any larger cause)
+
+static double		perfInstrs;	// instrsExecuted at last SYNC_SIM_TIME
+static double		perfUs;		// usElapsed at last SYNC_SIM_TIME
+static double		perfUsPerInst = 1.0;
+static uint32		perfWalks, perfLoads, perfStores, perfExcSel;
+static uint32		perfExc[DLX_PERF_EXC_CAUSES];
+
 static
+inline
 int
-InstSeqi (uint32 inst, Cpu *cpu)
+PerfIsCounter (uint32 sreg)
 {
-  uint32	src1, imm, dst;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  cpu->PutIreg (dst, (cpu->GetIreg(src1) == imm) ? 1 : 0);
-  return (1);
+  return ((sreg >= DLX_SREG_PERF_INSTRS_LO) && (sreg <= DLX_SREG_PERF_EXC));
 }
 
 static
-int
-InstSnei (uint32 inst, Cpu *cpu)
+inline
+void
+PerfException (uint32 cause)
 {
-  uint32	src1, imm, dst;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  cpu->PutIreg (dst, (cpu->GetIreg(src1) != imm) ? 1 : 0);
-  return (1);
+  perfExc[(cause < DLX_PERF_EXC_TRAPS) ? cause : DLX_PERF_EXC_TRAPS]++;
 }
 
+// The clock is CPU 0's; on another CPU, sync CPU 0 and copy its time.
+#define	SYNC_CPU_TIME(c)						\
+  do {									\
+    (c)->usElapsed += (double)(simInstrs - syncedInstrs) * (c)->usPerInst; \
+    (c)->instrsExecuted += (double)((simInstrs - syncedInstrs) -	\
+				    (stallCycles - syncedStalls));	\
+    syncedInstrs = simInstrs;						\
+    syncedStalls = stallCycles;						\
+    perfInstrs = (c)->instrsExecuted;					\
+    perfUs = (c)->usElapsed;						\
+    perfUsPerInst = (c)->usPerInst;					\
+  } while (0)
+
+#define	SYNC_SIM_TIME()							\
+  do {									\
+    if (mpCur == mpCpus) {						\
+      SYNC_CPU_TIME (this);						\
+    } else {								\
+      SYNC_CPU_TIME (mpCpus[0].cpu);					\
+      usElapsed = mpCpus[0].cpu->usElapsed;				\
+    }									\
+  } while (0)
+
+//----------------------------------------------------------------------
+//
+//	PerfRead
+//
+//	Return the current value of a performance counter.  The time and
+//	instruction counts are only synced at events, so add on what's
+//	been run since.
+//
+//----------------------------------------------------------------------
 static
-int
-InstSlti (uint32 inst, Cpu *cpu)
+uint32
+PerfRead (uint32 n)
 {
-  uint32	src1, imm, dst;
+  unsigned long long	v;
 
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) < (int)imm) ? 1 : 0);
-  return (1);
+  if ((n >= DLX_PERF_EXC) && (n < DLX_PERF_EXC + DLX_PERF_EXC_CAUSES)) {
+    return (perfExc[n - DLX_PERF_EXC]);
+  }
+  switch (n) {
+  case DLX_SREG_PERF_INSTRS_LO:
+  case DLX_SREG_PERF_INSTRS_HI:
+    v = (unsigned long long)perfInstrs + (simInstrs - syncedInstrs) -
+      (stallCycles - syncedStalls);
+    return ((n == DLX_SREG_PERF_INSTRS_LO) ? (uint32)v : (uint32)(v >> 32));
+  case DLX_SREG_PERF_US_LO:
+  case DLX_SREG_PERF_US_HI:
+    v = (unsigned long long)(perfUs + (double)(simInstrs - syncedInstrs) *
+			     perfUsPerInst);
+    return ((n == DLX_SREG_PERF_US_LO) ? (uint32)v : (uint32)(v >> 32));
+  case DLX_SREG_PERF_WALKS:
+    return (perfWalks);
+  case DLX_SREG_PERF_LOADS:
+    return (perfLoads);
+  case DLX_SREG_PERF_STORES:
+    return (perfStores);
+  case DLX_SREG_PERF_EXCSEL:
+    return (perfExcSel);
+  case DLX_SREG_PERF_EXC:
+    return (perfExc[perfExcSel % DLX_PERF_EXC_CAUSES]);
+  }
+  return (0);
 }
 
+//----------------------------------------------------------------------
+//
+//	Keyboard input
+//
+//	DLXSIM_KBD picks how keyboard input reaches the guest:
+//
+//		thread	(the default) a host thread blocks reading stdin
+//		poll	GetCharIfAvail every DLX_KBD_FREQUENCY instructions
+//		off	no input at all, for batch runs
+//
+//	The input thread puts what it reads in kbdHost, sets kbdPending
+//	and forces an event check by zeroing nextEvent, so the main loop
+//	only ever tests nextEvent.  EventsSchedule re-checks kbdPending
+//	after recomputing nextEvent, so that store can't be lost.  Both
+//	variables are shared with the thread, so they're only touched
+//	with the __atomic builtins; everything else it shares (kbdHost
+//	and its head and count) is under kbdLock.  The event check moves
+//	the characters into the Cpu's kbdbuffer and raises the keyboard
+//	interrupt, retrying every DLX_KBD_FREQUENCY instructions while
+//	interrupts are masked or kbdbuffer is full.  The thread exits at
+//	end of file, so a run with stdin from /dev/null costs nothing.
+//
+//----------------------------------------------------------------------
+#define	DLX_KBD_THREAD		0
+#define	DLX_KBD_POLL		1
+#define	DLX_KBD_OFF		2
+
+#define	DLX_KBD_HOST_SIZE	4096
+
+static int		kbdMode;
+static pthread_mutex_t	kbdLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char	kbdHost[DLX_KBD_HOST_SIZE];
+static int		kbdHostHead, kbdHostCount;
+static int		kbdPending;
+
 static
-int
-InstSgti (uint32 inst, Cpu *cpu)
+void *
+KbdReader (void *)
 {
-  uint32	src1, imm, dst;
+  unsigned char	buf[256];
+  ssize_t	n;
+  int		i;
 
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) > (int)imm) ? 1 : 0);
-  return (1);
+  while (((n = read (0, buf, sizeof (buf))) > 0) ||
+	 ((n < 0) && (errno == EINTR))) {
+    pthread_mutex_lock (&kbdLock);
+    for (i = 0; (i < n) && (kbdHostCount < DLX_KBD_HOST_SIZE); i++) {
+      kbdHost[(kbdHostHead + kbdHostCount++) % DLX_KBD_HOST_SIZE] = buf[i];
+    }
+    pthread_mutex_unlock (&kbdLock);
+    if (n > 0) {
+      __atomic_store_n (&kbdPending, 1, __ATOMIC_SEQ_CST);
+      __atomic_store_n (&nextEvent, 0, __ATOMIC_SEQ_CST);
+    }
+  }
+  return (NULL);
 }
 
 static
-int
-InstSlei (uint32 inst, Cpu *cpu)
+void
+KbdInit ()
 {
-  uint32	src1, imm, dst;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) <= (int)imm) ? 1 : 0);
-  return (1);
+  const char	*mode = getenv ("DLXSIM_KBD");
+  pthread_t	tid;
+
+  kbdMode = DLX_KBD_THREAD;
+  if (mode != NULL) {
+    if (!strcmp (mode, "poll")) {
+      kbdMode = DLX_KBD_POLL;
+    } else if (!strcmp (mode, "off")) {
+      kbdMode = DLX_KBD_OFF;
+    } else if (strcmp (mode, "thread")) {
+      fprintf (stderr, "Bad DLXSIM_KBD %s, using a thread.\n", mode);
+    }
+  }
+  if ((kbdMode == DLX_KBD_THREAD) &&
+      (pthread_create (&tid, NULL, KbdReader, NULL) != 0)) {
+    perror ("keyboard thread");
+    kbdMode = DLX_KBD_POLL;
+  } else if (kbdMode == DLX_KBD_THREAD) {
+    pthread_detach (tid);
+  }
 }
 
+//----------------------------------------------------------------------
+//
+//	KbdTake
+//
+//	Move characters from the input thread into the ring buffer buf
+//	(of size bytes, holding count characters written at wpos).
+//	Returns the number moved.  Any that don't fit stay in kbdHost
+//	until there's room; left is set to how many that is.
+//
+//----------------------------------------------------------------------
 static
 int
-InstSgei (uint32 inst, Cpu *cpu)
+KbdTake (unsigned char *buf, int size, int& wpos, int& count, int& left)
 {
-  uint32	src1, imm, dst;
-
-  cpu->GetIFields (inst, src1, imm, dst);
-  cpu->SignExtend16 (imm);
-  cpu->PutIreg (dst, ((int)cpu->GetIreg(src1) >= (int)imm) ? 1 : 0);
-  return (1);
+  int		n = 0;
+
+  __atomic_store_n (&kbdPending, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock (&kbdLock);
+  while ((kbdHostCount > 0) && (count < size)) {
+    buf[wpos++] = kbdHost[kbdHostHead++];
+    wpos %= size;
+    kbdHostHead %= DLX_KBD_HOST_SIZE;
+    kbdHostCount--;
+    count++;
+    n++;
+  }
+  left = kbdHostCount;
+  pthread_mutex_unlock (&kbdLock);
+  return (n);
 }
-
+
 //----------------------------------------------------------------------
 //
-//	Load instructions
+//	Console output
+//
+//	Guest printf output (Cpu::Printf) goes to consoleFp: stdout, or
+//	the file named by DLXSIM_CONSOLE_FILE.  DLXSIM_CONSOLE_FLUSH picks
+//	when it's flushed:
+//
+//		always	after every printf (the default)
+//		size	only when the buffer fills
+//		N	at most every N ms of real time
+//
+//	With N, output left over from a printf is flushed by a
+//	DLX_EVENT_CONSOLE check every DLX_CONSOLE_CHECK instructions once
+//	its time is up, so it doesn't wait for the guest's next printf.
+//
+//	DLXSIM_CONSOLE_BUFFER sets the buffer size (default 1MB unless
+//	flushing always).  Whatever the policy, the console is flushed at
+//	exit and when the guest takes a fault, and flushes after every
+//	printf while debugging output (which goes to stderr) is on, so
+//	guest output stays in order with the simulator's diagnostics.
 //
 //----------------------------------------------------------------------
+#define	DLX_CONSOLE_ALWAYS	0
+#define	DLX_CONSOLE_SIZE	1
+#define	DLX_CONSOLE_TIME	2
+#define	DLX_CONSOLE_CHECK	(1 << 20)	// instructions between checks
+
+#define	DLX_CONSOLE_BUFFER	(1 << 20)
+
+static FILE		*consoleFp;
+static int		consolePolicy;
+static double		consoleInterval;	// us between timed flushes
+static double		consoleLastFlush;
+
 static
-int
-InstLw (uint32 inst, Cpu *cpu)
+double
+ConsoleNow ()
 {
-  uint32	addrReg, offset, dst, addr, val;
+  struct timeval	t;
 
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->ReadWord (addr, val)) {
-    return (0);
-  }
-  DBPRINTF ('l', "Loading word 0x%08x from location 0x%x.\n", val, addr);
-  cpu->TraceAccess("lw", dst, addr, val);
-  cpu->PutIreg (dst, val);
-  return (1);
+  gettimeofday (&t, NULL);
+  return ((double)t.tv_sec * 1e6 + (double)t.tv_usec);
 }
 
 static
-int
-InstLh (uint32 inst, Cpu *cpu)
+void
+ConsoleFlush ()
 {
-  uint32	addrReg, offset, dst, addr, val;
-  static int	shiftcount[4] = {16, 16, 0, 0};
-
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  // Half-word accesses must be 2-byte aligned
-  if ((addr & 0x1) == 1) {
-    cpu->CauseException (DLX_EXC_ADDRESS);
-    return (0);
-  }
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->ReadWord (addr & 0xfffffffc, val)) {
-    return (0);
+  if (consoleFp != NULL) {
+    fflush (consoleFp);
   }
-  val >>= shiftcount[addr & 0x3];
-  DBPRINTF ('l',"Loading signed half 0x%04x from location 0x%x.\n", val, addr);
-  cpu->TraceAccess("lh", dst, addr, val);
-  cpu->SignExtend16 (val);
-  cpu->PutIreg (dst, val);
-  return (1);
 }
 
 static
-int
-InstLhu (uint32 inst, Cpu *cpu)
+void
+ConsoleInit ()
 {
-  uint32	addrReg, offset, dst, addr, val;
-  static int	shiftcount[4] = {16, 16, 0, 0};
-
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  // Half-word accesses must be 2-byte aligned
-  if ((addr & 0x1) == 1) {
-    cpu->CauseException (DLX_EXC_ADDRESS);
-    return (0);
+  const char	*file = getenv ("DLXSIM_CONSOLE_FILE");
+  const char	*policy = getenv ("DLXSIM_CONSOLE_FLUSH");
+  const char	*s = getenv ("DLXSIM_CONSOLE_BUFFER");
+  size_t	size = DLX_CONSOLE_BUFFER;
+
+  consoleFp = stdout;
+  if ((file != NULL) && ((consoleFp = fopen (file, "w")) == NULL)) {
+    perror (file);
+    consoleFp = stdout;
   }
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->ReadWord (addr & 0xfffffffc, val)) {
-    return (0);
+  if ((policy == NULL) || !strcmp (policy, "always")) {
+    consolePolicy = DLX_CONSOLE_ALWAYS;
+  } else if (!strcmp (policy, "size")) {
+    consolePolicy = DLX_CONSOLE_SIZE;
+  } else {
+    consolePolicy = DLX_CONSOLE_TIME;
+    consoleInterval = atof (policy) * 1000.0;
   }
-  val >>= shiftcount[addr & 0x3];
-  val &= 0xffff;
-  DBPRINTF ('l',"Loading unsigned half 0x%04x from location 0x%x.\n",val,addr);
-  cpu->TraceAccess("lhu", dst, addr, val);
-  cpu->PutIreg (dst, val);
-  return (1);
+  if ((consolePolicy != DLX_CONSOLE_ALWAYS) || (s != NULL)) {
+    if (s != NULL) {
+      size = strtoul (s, NULL, 0);
+    }
+    fflush (consoleFp);
+    setvbuf (consoleFp, NULL, _IOFBF, size);
+  }
+  consoleLastFlush = ConsoleNow ();
+  eventAt[DLX_EVENT_CONSOLE] = DLX_EVENT_NEVER;
+  atexit (ConsoleFlush);
 }
 
+//----------------------------------------------------------------------
+//
+//	ConsoleDue
+//
+//	Flush the console if the timed policy's interval has passed since
+//	the last flush.  Returns non-zero if it flushed.
+//
+//----------------------------------------------------------------------
 static
 int
-InstLb (uint32 inst, Cpu *cpu)
+ConsoleDue ()
 {
-  uint32	addrReg, offset, dst, addr, val;
-  static int	shiftcount[4] = {24, 16, 8, 0};
+  double	now = ConsoleNow ();
 
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->ReadWord (addr & 0xfffffffc, val)) {
+  if (now - consoleLastFlush < consoleInterval) {
     return (0);
   }
-  val >>= shiftcount[addr & 0x3];
-  val &= 0xff;
-  DBPRINTF ('l',"Loading signed byte 0x%02x from location 0x%x.\n", val, addr);
-  cpu->TraceAccess("lb", dst, addr, val);
-  cpu->SignExtend8 (val);
-  cpu->PutIreg (dst, val);
+  fflush (consoleFp);
+  consoleLastFlush = now;
   return (1);
 }
 
-static
-int
-InstLbu (uint32 inst, Cpu *cpu)
-{
-  uint32	addrReg, offset, dst, addr, val;
-  static int	shiftcount[4] = {24, 16, 8, 0};
+//----------------------------------------------------------------------
+//
+//	ConsoleWritten
+//
+//	Called after each guest printf to apply the flush policy.
+//
+//----------------------------------------------------------------------
+static
+inline
+void
+ConsoleWritten ()
+{
+  if ((consolePolicy == DLX_CONSOLE_ALWAYS) || debug[0]) {
+    fflush (consoleFp);
+  } else if (consolePolicy == DLX_CONSOLE_TIME) {
+    if (ConsoleDue ()) {
+      eventAt[DLX_EVENT_CONSOLE] = DLX_EVENT_NEVER;
+    } else if (eventAt[DLX_EVENT_CONSOLE] == DLX_EVENT_NEVER) {
+      // Output is waiting: have the event loop check the time.  As in
+      // EventsSchedule, don't lose a store from the keyboard thread.
+      eventAt[DLX_EVENT_CONSOLE] = simInstrs + DLX_CONSOLE_CHECK;
+      if (eventAt[DLX_EVENT_CONSOLE] <
+	  __atomic_load_n (&nextEvent, __ATOMIC_RELAXED)) {
+	__atomic_store_n (&nextEvent, eventAt[DLX_EVENT_CONSOLE],
+			  __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&kbdPending, __ATOMIC_SEQ_CST)) {
+	  __atomic_store_n (&nextEvent, 0, __ATOMIC_SEQ_CST);
+	}
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------
+//
+//	Execution statistics
+//
+//	If DLXSIM_STATS names a file, every instruction executed is counted
+//	by its entry in rrrInstrs, regInstrs or fpInstrs, and every trap
+//	by its vector (OS traps and simulator services alike).  Exit
+//	writes these, the exception counts by cause (perfExc) and the
+//	average number of instructions between timer interrupts to the
+//	file as CSV lines of kind,code,count.
+//
+//----------------------------------------------------------------------
+#define	DLX_STATS_MAX_VECTOR	0x3000	// larger vectors are lumped in here
+
+static FILE		*statsFp;
+static double		statsRrr[64], statsReg[64], statsFpu[32];
+static double		statsTraps[DLX_STATS_MAX_VECTOR + 1];
+
+static
+void
+StatsInit ()
+{
+  const char	*file = getenv ("DLXSIM_STATS");
+
+  if ((file != NULL) && ((statsFp = fopen (file, "w")) == NULL)) {
+    perror (file);
+  }
+}
+
+static
+inline
+void
+StatsInst (uint32 inst)
+{
+  switch ((inst >> DLX_OPCODE_SHIFT) & DLX_OPCODE_MASK) {
+  case 0x00:
+    statsRrr[(inst >> DLX_ALU_FUNC_CODE_SHIFT) & DLX_ALU_FUNC_CODE_MASK]++;
+    break;
+  case 0x01:
+    statsFpu[(inst >> DLX_FPU_FUNC_CODE_SHIFT) & DLX_FPU_FUNC_CODE_MASK]++;
+    break;
+  default:
+    statsReg[(inst >> DLX_OPCODE_SHIFT) & DLX_OPCODE_MASK]++;
+    break;
+  }
+}
+
+static
+inline
+void
+StatsTrap (uint32 vector)
+{
+  statsTraps[(vector < DLX_STATS_MAX_VECTOR) ? vector :
+	     DLX_STATS_MAX_VECTOR]++;
+}
+
+static
+void
+StatsWriteTable (const char *kind, const double *counts, int n)
+{
+  int		i;
+
+  for (i = 0; i < n; i++) {
+    if (counts[i] > 0.0) {
+      fprintf (statsFp, "%s,0x%02x,%.0lf\n", kind, i, counts[i]);
+    }
+  }
+}
+
+static
+void
+StatsReport (double instrs)
+{
+  uint32	timers = perfExc[DLX_EXC_TIMER];
+  int		i;
+
+  if (statsFp == NULL) {
+    return;
+  }
+  fprintf (statsFp, "kind,code,count\n");
+  StatsWriteTable ("rrr", statsRrr, 64);
+  StatsWriteTable ("reg", statsReg, 64);
+  StatsWriteTable ("fp", statsFpu, 32);
+  StatsWriteTable ("trap", statsTraps, DLX_STATS_MAX_VECTOR + 1);
+  for (i = 0; i < DLX_PERF_EXC_CAUSES; i++) {
+    if (perfExc[i] > 0) {
+      fprintf (statsFp, "%s,0x%02x,%u\n", (i == DLX_PERF_EXC_TRAPS) ?
+	       "exception-traps" : "exception", i, perfExc[i]);
+    }
+  }
+  fprintf (statsFp, "instrs,total,%.0lf\n", instrs);
+  fprintf (statsFp, "instrs,per-timer-interrupt,%.1lf\n",
+	   (timers > 0) ? instrs / timers : 0.0);
+  fclose (statsFp);
+  statsFp = NULL;
+}
+
+//----------------------------------------------------------------------
+//
+//	Page heat map
+//
+//	If DLXSIM_HEATMAP names a file, reads, writes and instruction
+//	fetches are counted for each physical page of memory.  Pages are
+//	1 << DLXSIM_HEATMAP_PAGEBITS bytes (4KB by default).  Each page
+//	also counts switches: user accesses made from a different address
+//	space (DLX_SREG_PGTBL_BASE) than the previous user access to it.
+//	A shared page that processes take turns at has a high count.
+//
+//	The counts go to the file as CSV lines of
+//	instrs,page,reads,writes,fetches,switches at exit, and every
+//	DLXSIM_HEATMAP_INTERVAL instructions if that's set.  Pages with no
+//	accesses are left out.  Counts are never reset, so subtract
+//	consecutive dumps to get the accesses in an interval.
+//
+//	The OS reads a count with DLX_TRAP_HEATMAP, which takes
+//	(page << 2) | kind in r1, kind being one of DLX_HEAT_*, and
+//	returns the count in r1.  It returns 0 for a page out of range,
+//	in user mode, or if the heat map is off.
+//
+//----------------------------------------------------------------------
+#define	DLX_TRAP_HEATMAP	0x2105
+
+#define	DLX_HEAT_READS		0
+#define	DLX_HEAT_WRITES		1
+#define	DLX_HEAT_FETCHES	2
+#define	DLX_HEAT_SWITCHES	3
+#define	DLX_HEAT_KINDS		4
+
+typedef struct HeatPage {
+  uint32	count[DLX_HEAT_KINDS];
+  uint32	lastSpace;	// page table base of the last user access
+} HeatPage;
+
+static FILE		*heatFp;
+static HeatPage		*heatPages;	// NULL if the heat map is off
+static uint32		heatNpages;
+static uint32		heatPageBits = 12;
+static long long	heatInterval;
+
+static
+void
+HeatInit (uint32 msize)
+{
+  const char	*file = getenv ("DLXSIM_HEATMAP");
+  const char	*s;
+
+  eventAt[DLX_EVENT_HEATMAP] = DLX_EVENT_NEVER;
+  if (file == NULL) {
+    return;
+  }
+  if ((heatFp = fopen (file, "w")) == NULL) {
+    perror (file);
+    return;
+  }
+  if ((s = getenv ("DLXSIM_HEATMAP_PAGEBITS")) != NULL) {
+    heatPageBits = atoi (s);
+    if ((heatPageBits < 2) || (heatPageBits > 30)) {
+      heatPageBits = 12;
+    }
+  }
+  // Physical addresses run up to and including msize.
+  heatNpages = (msize >> heatPageBits) + 1;
+  heatPages = new HeatPage[heatNpages];
+  memset (heatPages, 0, heatNpages * sizeof (HeatPage));
+  fprintf (heatFp, "instrs,page,reads,writes,fetches,switches\n");
+  if (((s = getenv ("DLXSIM_HEATMAP_INTERVAL")) != NULL) &&
+      ((heatInterval = atoll (s)) > 0)) {
+    eventAt[DLX_EVENT_HEATMAP] = heatInterval;
+  }
+}
+
+static
+void
+HeatReset ()
+{
+  if (heatPages != NULL) {
+    memset (heatPages, 0, heatNpages * sizeof (HeatPage));
+  }
+}
+
+static
+inline
+void
+HeatCount (uint32 paddr, int kind, int user, uint32 space)
+{
+  HeatPage	*h;
+
+  if ((paddr >> heatPageBits) >= heatNpages) {
+    return;
+  }
+  h = &heatPages[paddr >> heatPageBits];
+  h->count[kind]++;
+  if (user) {
+    if ((h->lastSpace != space) && (h->lastSpace != 0)) {
+      h->count[DLX_HEAT_SWITCHES]++;
+    }
+    h->lastSpace = space;
+  }
+}
+
+static
+uint32
+HeatRead (uint32 n)
+{
+  if ((heatPages == NULL) || ((n >> 2) >= heatNpages)) {
+    return (0);
+  }
+  return (heatPages[n >> 2].count[n & 0x3]);
+}
+
+static
+void
+HeatDump (double instrs)
+{
+  HeatPage	*h;
+  uint32	i;
+
+  if (heatFp == NULL) {
+    return;
+  }
+  for (i = 0; i < heatNpages; i++) {
+    h = &heatPages[i];
+    if ((h->count[DLX_HEAT_READS] | h->count[DLX_HEAT_WRITES] |
+	 h->count[DLX_HEAT_FETCHES]) != 0) {
+      fprintf (heatFp, "%.0lf,%u,%u,%u,%u,%u\n", instrs, i,
+	       h->count[DLX_HEAT_READS], h->count[DLX_HEAT_WRITES],
+	       h->count[DLX_HEAT_FETCHES], h->count[DLX_HEAT_SWITCHES]);
+    }
+  }
+  fflush (heatFp);
+}
+
+static
+void
+EventsSchedule ()
+{
+  int		i;
+  long long	next;
+
+  next = eventAt[0];
+  for (i = 1; i < DLX_EVENT_MAX; i++) {
+    if (eventAt[i] < next) {
+      next = eventAt[i];
+    }
+  }
+  // The keyboard thread may have zeroed nextEvent while it was being
+  // recomputed.
+  __atomic_store_n (&nextEvent, next, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&kbdPending, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n (&nextEvent, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+static
+void
+EventsIdle ()
+{
+  idleRequested = 1;
+  // Force an event check on the next instruction.
+  __atomic_store_n (&nextEvent, 0, __ATOMIC_SEQ_CST);
+}
+
+//----------------------------------------------------------------------
+//
+//	EventsTimerDeadline
+//
+//	Compute when the timer needs to be checked, given the current time
+//	and the time the interrupt is due.  Must be called right after
+//	SYNC_SIM_TIME.
+//
+//----------------------------------------------------------------------
+static
+void
+EventsTimerDeadline (double now, double due, double usPerInst)
+{
+  double	wait;
+
+  wait = (due - now) / usPerInst;
+  if (wait < 1.0) {
+    wait = 1.0;
+  } else if (wait > (double)DLX_EVENT_MAX_WAIT) {
+    wait = (double)DLX_EVENT_MAX_WAIT;
+  }
+  eventAt[DLX_EVENT_TIMER] = simInstrs + (long long)wait;
+  EventsSchedule ();
+}
+
+//----------------------------------------------------------------------
+//
+//	Cache model
+//
+//	Setting DLXSIM_CACHE turns on a model of split L1 instruction and
+//	data caches and an optional unified L2, fed by instruction fetches
+//	and by ReadWord/WriteWord accesses to memory.  It's configured by
+//	a comma-separated list in DLXSIM_CACHE, such as
+//
+//		l1i=16k:2:32,l1d=32k:4:32,l2=256k:8:64,repl=plru,memlat=80
+//
+//	where each cache is size:associativity:line size (use l2=0 for no
+//	L2), repl is lru or plru, and l2lat and memlat are the cycles a
+//	miss costs to reach the L2 and memory.  Anything not given takes
+//	the value in CacheInit.  Writes allocate like reads.
+//
+//	A cycle is one instruction time (usPerInst).  Stalls are added to
+//	simInstrs, so they advance the clock and the event deadlines, and
+//	are kept out of the instruction count.  Exit prints hits and
+//	misses for each cache, split by kernel and user mode.
+//
+//----------------------------------------------------------------------
+typedef struct CacheLevel {
+  const char	*name;
+  uint32	size, assoc, lineSize;
+  uint32	lineBits, nsets;
+  uint32	*tags;		// line number + 1, or 0 if invalid
+  uint32	*ages;		// LRU: time of last use
+  uint32	*plru;		// PLRU: tree bits for each set
+  uint32	clock;
+  double	hits[2], misses[2];	// [0] kernel, [1] user
+} CacheLevel;
+
+static int		cacheModel;	// non-zero if DLXSIM_CACHE is set
+static int		cachePlru;
+static uint32		cacheL2Latency, cacheMemLatency;
+static CacheLevel	cacheL1I, cacheL1D, cacheL2;
+
+static
+int
+CacheConfigure (CacheLevel *c, const char *name)
+{
+  uint32	i;
+
+  c->name = name;
+  if (c->size == 0) {
+    return (1);
+  }
+  for (c->lineBits = 0; (1U << c->lineBits) < c->lineSize; c->lineBits++) {
+  }
+  c->nsets = (c->assoc > 0) ? c->size / (c->lineSize * c->assoc) : 0;
+  if ((c->lineSize != (1U << c->lineBits)) || (c->nsets == 0) ||
+      ((c->nsets & (c->nsets - 1)) != 0) || (c->assoc > 32) ||
+      (cachePlru && ((c->assoc & (c->assoc - 1)) != 0))) {
+    fprintf (stderr, "Bad %s cache geometry %d:%d:%d.\n", name, c->size,
+	     c->assoc, c->lineSize);
+    return (0);
+  }
+  c->tags = new uint32[c->nsets * c->assoc];
+  c->ages = new uint32[c->nsets * c->assoc];
+  c->plru = new uint32[c->nsets];
+  for (i = 0; i < c->nsets * c->assoc; i++) {
+    c->tags[i] = c->ages[i] = 0;
+  }
+  for (i = 0; i < c->nsets; i++) {
+    c->plru[i] = 0;
+  }
+  return (1);
+}
+
+static
+uint32
+CacheSize (const char *s, char **end)
+{
+  uint32	v = strtoul (s, end, 10);
+
+  if ((**end == 'k') || (**end == 'K')) {
+    v <<= 10;
+    (*end)++;
+  } else if ((**end == 'm') || (**end == 'M')) {
+    v <<= 20;
+    (*end)++;
+  }
+  return (v);
+}
+
+static
+void
+CacheInit ()
+{
+  const char	*env = getenv ("DLXSIM_CACHE");
+  char		*config, *opt, *val, *end;
+  CacheLevel	*c;
+
+  if (env == NULL) {
+    return;
+  }
+  cacheL1I.size = cacheL1D.size = 16 << 10;
+  cacheL1I.assoc = cacheL1D.assoc = 2;
+  cacheL1I.lineSize = cacheL1D.lineSize = 32;
+  cacheL2.size = 0;
+  cacheL2.assoc = 8;
+  cacheL2.lineSize = 64;
+  cacheL2Latency = 10;
+  cacheMemLatency = 50;
+  config = strdup (env);
+  for (opt = strtok (config, ","); opt != NULL; opt = strtok (NULL, ",")) {
+    if ((val = index (opt, '=')) == NULL) {
+      continue;
+    }
+    *val++ = '\0';
+    c = NULL;
+    if (!strcmp (opt, "l1i")) {
+      c = &cacheL1I;
+    } else if (!strcmp (opt, "l1d")) {
+      c = &cacheL1D;
+    } else if (!strcmp (opt, "l2")) {
+      c = &cacheL2;
+    } else if (!strcmp (opt, "repl")) {
+      cachePlru = !strcmp (val, "plru");
+    } else if (!strcmp (opt, "l2lat")) {
+      cacheL2Latency = strtoul (val, NULL, 10);
+    } else if (!strcmp (opt, "memlat")) {
+      cacheMemLatency = strtoul (val, NULL, 10);
+    } else {
+      fprintf (stderr, "Unknown cache option %s.\n", opt);
+    }
+    if (c != NULL) {
+      c->size = CacheSize (val, &end);
+      if (*end == ':') {
+	c->assoc = strtoul (end + 1, &end, 10);
+      }
+      if (*end == ':') {
+	c->lineSize = CacheSize (end + 1, &end);
+      }
+    }
+  }
+  free (config);
+  if ((cacheL1I.size == 0) || (cacheL1D.size == 0) ||
+      !CacheConfigure (&cacheL1I, "L1I") ||
+      !CacheConfigure (&cacheL1D, "L1D") ||
+      !CacheConfigure (&cacheL2, "L2")) {
+    fprintf (stderr, "Cache model disabled.\n");
+    return;
+  }
+  cacheModel = 1;
+}
+
+//----------------------------------------------------------------------
+//
+//	CacheReset
+//
+//	Empty every cache and zero the counts, as at startup.  Used when a
+//	checkpoint is restored, since the caches held the old run's lines.
+//
+//----------------------------------------------------------------------
+static
+void
+CacheReset ()
+{
+  CacheLevel	*levels[3] = {&cacheL1I, &cacheL1D, &cacheL2};
+  CacheLevel	*c;
+  int		i;
+
+  if (!cacheModel) {
+    return;
+  }
+  for (i = 0; i < 3; i++) {
+    c = levels[i];
+    if (c->size == 0) {
+      continue;
+    }
+    memset (c->tags, 0, c->nsets * c->assoc * sizeof (uint32));
+    memset (c->ages, 0, c->nsets * c->assoc * sizeof (uint32));
+    memset (c->plru, 0, c->nsets * sizeof (uint32));
+    c->clock = 0;
+    c->hits[0] = c->hits[1] = c->misses[0] = c->misses[1] = 0.0;
+  }
+}
+
+//----------------------------------------------------------------------
+//
+//	CacheLookup
+//
+//	Look up a physical address in one cache, filling the line on a
+//	miss.  Returns 1 on a hit.
+//
+//----------------------------------------------------------------------
+static
+inline
+void
+CacheTouch (CacheLevel *c, uint32 set, uint32 way)
+{
+  uint32	node, bit, level;
+
+  if (!cachePlru) {
+    c->ages[set * c->assoc + way] = ++c->clock;
+    return;
+  }
+  // Point every node on the path away from this way.
+  node = 1;
+  for (level = c->assoc >> 1; level > 0; level >>= 1) {
+    bit = (way & level) ? 1 : 0;
+    if (bit) {
+      c->plru[set] &= ~(1 << node);
+    } else {
+      c->plru[set] |= (1 << node);
+    }
+    node = 2 * node + bit;
+  }
+}
+
+static
+int
+CacheLookup (CacheLevel *c, uint32 paddr, int user)
+{
+  uint32	tag = (paddr >> c->lineBits) + 1;
+  uint32	set = (paddr >> c->lineBits) & (c->nsets - 1);
+  uint32	*t = c->tags + set * c->assoc;
+  uint32	way, victim, node, level;
+
+  for (way = 0; way < c->assoc; way++) {
+    if (t[way] == tag) {
+      c->hits[user]++;
+      CacheTouch (c, set, way);
+      return (1);
+    }
+  }
+  c->misses[user]++;
+  for (victim = 0; (victim < c->assoc) && (t[victim] != 0); victim++) {
+  }
+  if (victim == c->assoc) {
+    if (cachePlru) {
+      node = 1;
+      victim = 0;
+      for (level = c->assoc >> 1; level > 0; level >>= 1) {
+	if (c->plru[set] & (1 << node)) {
+	  victim |= level;
+	  node = 2 * node + 1;
+	} else {
+	  node = 2 * node;
+	}
+      }
+    } else {
+      victim = 0;
+      for (way = 1; way < c->assoc; way++) {
+	if (c->ages[set * c->assoc + way] < c->ages[set * c->assoc + victim]) {
+	  victim = way;
+	}
+      }
+    }
+  }
+  t[victim] = tag;
+  CacheTouch (c, set, victim);
+  return (0);
+}
+
+static
+inline
+void
+CacheStall (uint32 cycles)
+{
+  simInstrs += cycles;
+  stallCycles += cycles;
+}
+
+static
+void
+CacheAccess (CacheLevel *l1, uint32 paddr, int user)
+{
+  user = user ? 1 : 0;
+  if (CacheLookup (l1, paddr, user)) {
+    return;
+  }
+  if (cacheL2.size > 0) {
+    CacheStall (cacheL2Latency);
+    if (CacheLookup (&cacheL2, paddr, user)) {
+      return;
+    }
+  }
+  CacheStall (cacheMemLatency);
+}
+
+static
+void
+CacheReport ()
+{
+  CacheLevel	*levels[3] = {&cacheL1I, &cacheL1D, &cacheL2};
+  CacheLevel	*c;
+  double	n;
+  int		i, user;
+
+  if (!cacheModel) {
+    return;
+  }
+  printf ("Cache stall cycles: %lld\n", stallCycles - diskStallCycles);
+  for (i = 0; i < 3; i++) {
+    c = levels[i];
+    if (c->size == 0) {
+      continue;
+    }
+    for (user = 0; user < 2; user++) {
+      n = c->hits[user] + c->misses[user];
+      printf ("%s %s: %.0lf accesses, %.0lf misses (%.2lf%%)\n", c->name,
+	      user ? "user" : "kernel", n, c->misses[user],
+	      (n > 0.0) ? 100.0 * c->misses[user] / n : 0.0);
+    }
+  }
+}
+
+//----------------------------------------------------------------------
+//
+//	MemoryWritten
+//	MemoryRangeWritten
+//
+//	Must be called whenever simulated physical memory is modified
+//	so that anything derived from its old contents gets dropped,
+//	including ll reservations on it.
+//
+//----------------------------------------------------------------------
+static
+inline
+void
+MemoryWritten (uint32 paddr)
+{
+  PredecodeInvalidate (paddr);
+  XlateInvalidate (paddr);
+  BlockInvalidate (paddr);
+  if (llAny) {
+    LlBreak (paddr, 4);
+  }
+}
+
+static
+void
+MemoryRangeWritten (uint32 paddr, uint32 nbytes)
+{
+  uint32	a;
+
+  PredecodeInvalidateRange (paddr, nbytes);
+  XlateInvalidateRange (paddr, nbytes);
+  if (llAny) {
+    LlBreak (paddr, nbytes);
+  }
+  for (a = paddr & ~(DLX_BLOCK_CHUNK - 1); a < paddr + nbytes;
+       a += DLX_BLOCK_CHUNK) {
+    BlockInvalidate (a);
+  }
+}
+
+//----------------------------------------------------------------------
+//
+//	Disk timing model
+//
+//	Setting DLXSIM_DISK_MODEL makes disk I/O take simulated time.  It's
+//	a comma-separated list such as
+//
+//		seekmin=0.5,seekmax=10,rpm=7200,xfer=50,cyls=256,file=.img
+//
+//	seekmin and seekmax are the track-to-track and full-stroke seek
+//	times in ms, rpm the spindle speed, xfer the media transfer rate
+//	in MB/s (which also sets the number of blocks on a track) and cyls
+//	the number of cylinders.  A request costs a seek that grows with
+//	the square root of the cylinder distance, the rotational delay
+//	until its first block comes under the head, and the transfer.
+//	There's one head, shared by every modelled file and the DMA disk.
+//
+//	Host file reads and writes (DLX_TRAP_READ and DLX_TRAP_WRITE) on
+//	files whose name contains the file= string (any file if it's not
+//	given) stall the CPU for the access time, at the file offset they
+//	start from.  The DMA disk uses the model for its request times
+//	instead of DLXSIM_DISK_LATENCY.  Exit prints the totals.
+//
+//----------------------------------------------------------------------
+#define	DLX_DISKMODEL_BLOCK	512
+
+static int		diskModel;	// non-zero if DLXSIM_DISK_MODEL is set
+static double		diskSeekMin, diskSeekMax, diskRevUs, diskBlocksPerTrack;
+static uint32		diskCyls, diskHeadCyl;
+static char		diskModelFile[100];
+static char		diskModelFds[DLX_MAX_FILES];	// set by Cpu::Open
+static double		diskRequests, diskSeekUs, diskRotUs, diskXferUs;
+
+static
+void
+DiskModelInit ()
+{
+  const char	*s = getenv ("DLXSIM_DISK_MODEL");
+  char		buf[200];
+  char		*opt, *val;
+  double	rpm = 7200.0, xfer = 50.0;
+
+  if (s == NULL) {
+    return;
+  }
+  diskSeekMin = 0.5;
+  diskSeekMax = 10.0;
+  diskCyls = 256;
+  strncpy (buf, s, sizeof (buf) - 1);
+  buf[sizeof (buf) - 1] = '\0';
+  for (opt = strtok (buf, ","); opt != NULL; opt = strtok (NULL, ",")) {
+    if ((val = strchr (opt, '=')) == NULL) {
+      fprintf (stderr, "Bad DLXSIM_DISK_MODEL option %s.\n", opt);
+      continue;
+    }
+    *val++ = '\0';
+    if (!strcmp (opt, "seekmin")) {
+      diskSeekMin = atof (val);
+    } else if (!strcmp (opt, "seekmax")) {
+      diskSeekMax = atof (val);
+    } else if (!strcmp (opt, "rpm")) {
+      rpm = atof (val);
+    } else if (!strcmp (opt, "xfer")) {
+      xfer = atof (val);
+    } else if (!strcmp (opt, "cyls")) {
+      diskCyls = atoi (val);
+    } else if (!strcmp (opt, "file")) {
+      strncpy (diskModelFile, val, sizeof (diskModelFile) - 1);
+    } else {
+      fprintf (stderr, "Bad DLXSIM_DISK_MODEL option %s.\n", opt);
+    }
+  }
+  if ((rpm <= 0.0) || (xfer <= 0.0) || (diskCyls == 0)) {
+    fprintf (stderr, "Bad DLXSIM_DISK_MODEL %s, not modelling the disk.\n",
+	     s);
+    return;
+  }
+  // Times are kept in us; xfer is in MB/s, which is bytes per us.
+  diskSeekMin *= 1000.0;
+  diskSeekMax *= 1000.0;
+  diskRevUs = 60e6 / rpm;
+  diskBlocksPerTrack = xfer * diskRevUs / DLX_DISKMODEL_BLOCK;
+  if (diskBlocksPerTrack < 1.0) {
+    diskBlocksPerTrack = 1.0;
+  }
+  diskModel = 1;
+}
+
+//----------------------------------------------------------------------
+//
+//	DiskModelOpened
+//
+//	Note whether the host file just opened as fd is one the disk
+//	model applies to, so reads and writes don't have to check its name.
+//
+//----------------------------------------------------------------------
+static
+void
+DiskModelOpened (int fd, const char *name)
+{
+  diskModelFds[fd] = diskModel && (strstr (name, diskModelFile) != NULL);
+}
+
+//----------------------------------------------------------------------
+//
+//	DiskModelTime
+//
+//	Return the time in us to access nbytes starting at block, for a
+//	request issued at time now, and move the head.
+//
+//----------------------------------------------------------------------
+static
+double
+DiskModelTime (double now, uint32 block, uint32 nbytes)
+{
+  uint32	cyl = (uint32)(block / diskBlocksPerTrack);
+  uint32	dist = (cyl > diskHeadCyl) ? cyl - diskHeadCyl : diskHeadCyl - cyl;
+  double	seek = 0.0, rot, xfer, angle;
+
+  if (dist > 0) {
+    seek = diskSeekMin + (diskSeekMax - diskSeekMin) *
+      sqrt ((dist >= diskCyls) ? 1.0 : (double)dist / diskCyls);
+  }
+  // Fraction of a revolution from where the head is when the seek
+  // finishes to the start of the block.
+  angle = fmod (block, diskBlocksPerTrack) / diskBlocksPerTrack -
+    fmod (now + seek, diskRevUs) / diskRevUs;
+  rot = ((angle < 0.0) ? angle + 1.0 : angle) * diskRevUs;
+  xfer = (double)nbytes * diskRevUs /
+    (diskBlocksPerTrack * DLX_DISKMODEL_BLOCK);
+  diskHeadCyl = (uint32)((block + (nbytes - 1) / DLX_DISKMODEL_BLOCK) /
+			 diskBlocksPerTrack);
+  diskRequests += 1.0;
+  diskSeekUs += seek;
+  diskRotUs += rot;
+  diskXferUs += xfer;
+  return (seek + rot + xfer);
+}
+
+static
+void
+DiskModelReport ()
+{
+  if (!diskModel || (diskRequests == 0.0)) {
+    return;
+  }
+  printf ("Disk model: %.0lf requests, %.3lf secs seeking, %.3lf secs "
+	  "rotating, %.3lf secs transferring\n", diskRequests,
+	  diskSeekUs / 1e6, diskRotUs / 1e6, diskXferUs / 1e6);
+}
+
+//----------------------------------------------------------------------
+//
+//	DMA disk controller
+//
+//	If DLXSIM_DISK names an image file, it's mapped and served as a
+//	disk of DLX_DMA_BLOCK_SIZE (512) byte blocks.  The OS builds a descriptor
+//	of five words in physical memory:
+//
+//		op (DLX_DMA_OP_READ or DLX_DMA_OP_WRITE), first block,
+//		physical address, number of blocks, status
+//
+//	and queues it by writing its address to DLX_DMA_QUEUE.  Requests
+//	are served in order, each taking DLXSIM_DISK_LATENCY plus
+//	DLXSIM_DISK_BLOCK_US microseconds per block of simulated time, or
+//	the time the disk timing model gives if DLXSIM_DISK_MODEL is set.
+//	When one finishes, the data is copied between the image and guest
+//	memory, the status word is set to DLX_DMA_STATUS_DONE (or _ERROR),
+//	and a DLX_EXC_DISK interrupt is raised.  Reading DLX_DMA_DONE
+//	returns the address of the oldest finished descriptor (0 if none)
+//	and removes it.  While any remain, the simulator keeps checking
+//	every instruction and raises the interrupt again as soon as the
+//	interrupt level lets it, so the OS may collect them all in one
+//	handler or one per interrupt.
+//
+//----------------------------------------------------------------------
+#define	DLX_DMA_QUEUE		0xfff00500
+#define	DLX_DMA_DONE		0xfff00504
+#define	DLX_DMA_PENDING		0xfff00508
+#define	DLX_DMA_NBLOCKS		0xfff0050c
+#define	DLX_DMA_BLOCKSIZE	0xfff00510
+
+#ifndef	DLX_EXC_DISK
+#define	DLX_EXC_DISK		0x50
+#endif
+
+#define	DLX_DMA_OP_READ		1	// disk to memory
+#define	DLX_DMA_OP_WRITE	2	// memory to disk
+#define	DLX_DMA_STATUS_PENDING	0
+#define	DLX_DMA_STATUS_DONE	1
+#define	DLX_DMA_STATUS_ERROR	0xffffffff
+
+#define	DLX_DMA_BLOCK_SIZE	512
+#define	DLX_DMA_MAX_QUEUE	64
+
+typedef struct DmaRequest {
+  uint32	desc;		// physical address of the descriptor
+  uint32	op, block, paddr, count;
+} DmaRequest;
+
+static unsigned char	*dmaImage;
+static uint32		dmaNblocks;
+static double		dmaLatency, dmaBlockUs;
+static DmaRequest	dmaQueue[DLX_DMA_MAX_QUEUE];
+static int		dmaHead, dmaCount;
+static uint32		dmaDone[DLX_DMA_MAX_QUEUE];
+static int		dmaDoneHead, dmaDoneCount;
+static double		dmaBlocks;	// blocks transferred, for Exit
+static long long	dmaFinishAt;	// when the head request completes
+
+static
+void
+DmaInit ()
+{
+  const char	*file = getenv ("DLXSIM_DISK");
+  const char	*s;
+  struct stat	st;
+  int		fd;
+
+  eventAt[DLX_EVENT_DISK] = dmaFinishAt = DLX_EVENT_NEVER;
+  if (file == NULL) {
+    return;
+  }
+  if (((fd = open (file, O_RDWR)) < 0) || (fstat (fd, &st) < 0)) {
+    perror (file);
+    return;
+  }
+  dmaNblocks = st.st_size / DLX_DMA_BLOCK_SIZE;
+  dmaImage = (unsigned char *)mmap (NULL, st.st_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED, fd, 0);
+  close (fd);
+  if ((dmaNblocks == 0) || (dmaImage == (unsigned char *)MAP_FAILED)) {
+    fprintf (stderr, "Can't use %s as a disk image.\n", file);
+    dmaImage = NULL;
+    dmaNblocks = 0;
+    return;
+  }
+  dmaLatency = ((s = getenv ("DLXSIM_DISK_LATENCY")) != NULL) ?
+    atof (s) : 1000.0;
+  dmaBlockUs = ((s = getenv ("DLXSIM_DISK_BLOCK_US")) != NULL) ?
+    atof (s) : 20.0;
+}
+
+//----------------------------------------------------------------------
+//
+//	DmaStart
+//
+//	Schedule completion of the request at the head of the queue,
+//	which starts at time now.
+//
+//----------------------------------------------------------------------
+static
+void
+DmaStart (double now, double usPerInst)
+{
+  DmaRequest	*r = &dmaQueue[dmaHead];
+  double	wait;
+
+  if (dmaCount == 0) {
+    dmaFinishAt = DLX_EVENT_NEVER;
+  } else {
+    if (diskModel) {
+      wait = DiskModelTime (now, r->block, r->count * DLX_DMA_BLOCK_SIZE);
+    } else {
+      wait = dmaLatency + dmaBlockUs * r->count;
+    }
+    wait /= usPerInst;
+    dmaFinishAt = simInstrs + ((wait < 1.0) ? 1 : (long long)wait);
+  }
+  // Finished requests still waiting to be collected keep the event
+  // coming every instruction; see the DLX_EVENT_DISK check in ExecOne.
+  eventAt[DLX_EVENT_DISK] = (dmaDoneCount > 0) ? simInstrs + 1 : dmaFinishAt;
+  EventsSchedule ();
+}
+
+//----------------------------------------------------------------------
+//
+//	DmaFinish
+//
+//	Do the transfer for the request at the head of the queue and move
+//	it to the done list.  Returns the new status for its descriptor.
+//
+//----------------------------------------------------------------------
+static
+uint32
+DmaFinish (unsigned char *mem, uint32 msize, uint32& desc)
+{
+  DmaRequest	*r = &dmaQueue[dmaHead];
+  uint32	nbytes = r->count * DLX_DMA_BLOCK_SIZE;
+  uint32	status = DLX_DMA_STATUS_DONE;
+
+  desc = r->desc;
+  dmaHead = (dmaHead + 1) % DLX_DMA_MAX_QUEUE;
+  dmaCount--;
+  if ((r->block >= dmaNblocks) || (r->count > dmaNblocks - r->block) ||
+      (r->paddr > msize) || (nbytes > msize - r->paddr) ||
+      ((r->op != DLX_DMA_OP_READ) && (r->op != DLX_DMA_OP_WRITE))) {
+    status = DLX_DMA_STATUS_ERROR;
+  } else if (r->op == DLX_DMA_OP_READ) {
+    memcpy (mem + r->paddr, dmaImage + r->block * DLX_DMA_BLOCK_SIZE,
+	    nbytes);
+    MemoryRangeWritten (r->paddr, nbytes);
+  } else {
+    memcpy (dmaImage + r->block * DLX_DMA_BLOCK_SIZE, mem + r->paddr,
+	    nbytes);
+  }
+  DBPRINTF ('F', "DMA op %d of %d blocks at %d, paddr 0x%x: status %d\n",
+	    r->op, r->count, r->block, r->paddr, (int)status);
+  dmaBlocks += r->count;
+  if (dmaDoneCount < DLX_DMA_MAX_QUEUE) {
+    dmaDone[(dmaDoneHead + dmaDoneCount++) % DLX_DMA_MAX_QUEUE] = desc;
+  }
+  return (status);
+}
+
+static
+uint32
+DmaPopDone ()
+{
+  uint32	desc;
+
+  if (dmaDoneCount == 0) {
+    return (0);
+  }
+  desc = dmaDone[dmaDoneHead];
+  dmaDoneHead = (dmaDoneHead + 1) % DLX_DMA_MAX_QUEUE;
+  dmaDoneCount--;
+  return (desc);
+}
+
+//----------------------------------------------------------------------
+//
+//	Bulk memory operations
+//
+//	DLX_TRAP_MEMMOVE (dst, src, n) and DLX_TRAP_MEMSET (dst, c, n) do
+//	a memmove or memset on physical memory with the host's routines,
+//	for the OS's bcopy and bzero.  They only work in system mode with
+//	translation off, and return n if they did the operation and 0
+//	otherwise (bad range, or called from a mode where the addresses
+//	aren't physical), in which case the caller should copy by hand.
+//
+//----------------------------------------------------------------------
+#define	DLX_TRAP_MEMMOVE	0x2102
+#define	DLX_TRAP_MEMSET		0x2103
+
+// Set by Cpu::Cpu and by checkpoint restore, which replaces memory.
+static unsigned char	*bulkMemory;
+static uint32		bulkMemSize;
+
+//----------------------------------------------------------------------
+//
+//	BulkParam
+//
+//	Same as Cpu::GetParam: parameters are on the stack.
+//
+//----------------------------------------------------------------------
+static
+uint32
+BulkParam (Cpu *cpu, int p)
+{
+  uint32	addr = (cpu->GetIreg (29) + (p << 2)) & ~0x3;
+  unsigned char	*b = bulkMemory + addr;
+
+  if (addr + 4 > bulkMemSize) {
+    return (0);
+  }
+  return ((b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]);
+}
+
+static
+uint32
+BulkMemory (Cpu *cpu, uint32 trapVector)
+{
+  uint32	dst = BulkParam (cpu, 0);
+  uint32	arg = BulkParam (cpu, 1);
+  uint32	n = BulkParam (cpu, 2);
+
+  if (cpu->UserMode () ||
+      (cpu->GetSreg (DLX_SREG_STATUS) &
+       (DLX_STATUS_XLATE_RD | DLX_STATUS_XLATE_WR)) ||
+      (dst > bulkMemSize) || (n > bulkMemSize - dst)) {
+    return (0);
+  }
+  if (trapVector == DLX_TRAP_MEMMOVE) {
+    if ((arg > bulkMemSize) || (n > bulkMemSize - arg)) {
+      return (0);
+    }
+    memmove (bulkMemory + dst, bulkMemory + arg, n);
+  } else {
+    memset (bulkMemory + dst, arg, n);
+  }
+  MemoryRangeWritten (dst, n);
+  DBPRINTF ('m', "Bulk %s of %d bytes to 0x%x from 0x%x\n",
+	    (trapVector == DLX_TRAP_MEMMOVE) ? "move" : "set", n, dst, arg);
+  return (n);
+}
+
+//----------------------------------------------------------------------
+//
+//	Checkpoints
+//
+//	If DLXSIM_CHECKPOINT names a file, the checkpoint trap saves the
+//	whole machine there: registers, the software TLB, the simulated
+//	clock and timer, the DMA queue and disk head, the host files the
+//	guest has open, and guest memory.  The models that only gather
+//	statistics (the caches, stall counts and heat map) start again
+//	empty on restore; deadlines for the profiler, heat map and console
+//	are moved to the restored instruction count.  Starting with DLXSIM_RESTORE set to that file resumes
+//	right after the trap, so the OS only has to boot once.
+//
+//	The trap returns 0 after saving, 1 in a run resumed from the
+//	checkpoint, and -1 if nothing was saved.  Both the save and the
+//	restore are done by the next event check, where ExecOne is between
+//	instructions.  The header is followed by the swtlbEntries entries
+//	of the software TLB.  Guest memory comes after them, page-aligned,
+//	and is mapped copy-on-write on restore, so it isn't read until
+//	touched.
+//	Checkpoints are only valid for the dlxsim binary that wrote them.
+//
+//----------------------------------------------------------------------
+#define	DLX_TRAP_CHECKPOINT	0x2101
+
+#define	DLX_CKPT_MAGIC		0x444c5843	// "DLXC"
+#define	DLX_CKPT_VERSION	3
+#define	DLX_CKPT_NAMELEN	100
+
+typedef struct CkptFile {
+  int		accessType;	// as passed to Cpu::Open; 0 if not open
+  long		offset;
+  char		name[DLX_CKPT_NAMELEN];
+} CkptFile;
+
+typedef struct CkptHeader {
+  uint32	magic;
+  uint32	version;
+  uint32	headerSize;
+  uint32	memSize;
+  uint32	memOffset;	// file offset of guest memory
+  uint32	pc;
+  uint32	ireg[32], freg[32], sreg[32];
+  double	usElapsed, instrsExecuted, timerInterrupt, idleUsSkipped;
+  long long	simInstrs;
+  uint32	swtlbEntries;	// entries following the header
+  uint32	swtlbIndex, swtlbHi, swtlbLo, swtlbNext;
+  DmaRequest	dmaQueue[DLX_DMA_MAX_QUEUE];
+  uint32	dmaDone[DLX_DMA_MAX_QUEUE];
+  int		dmaHead, dmaCount, dmaDoneHead, dmaDoneCount;
+  long long	dmaFinishAt;
+  uint32	diskHeadCyl;
+  CkptFile	files[DLX_MAX_FILES];
+} CkptHeader;
+
+static const char	*ckptSaveFile;
+static const char	*ckptRestoreFile;
+// Cpu::Open records what each host file was opened as, so it can be
+// opened again on restore.
+static char		ckptFileNames[DLX_MAX_FILES][DLX_CKPT_NAMELEN];
+static int		ckptFileModes[DLX_MAX_FILES];
+
+static
+void
+CheckpointRequest (Cpu *cpu)
+{
+  if (((ckptSaveFile = getenv ("DLXSIM_CHECKPOINT")) == NULL) ||
+      (mpRunning > 0)) {
+    cpu->PutIreg (1, 0xffffffff);
+    return;
+  }
+  eventAt[DLX_EVENT_CKPT] = 0;
+  __atomic_store_n (&nextEvent, 0, __ATOMIC_SEQ_CST);
+}
+
+//----------------------------------------------------------------------
+//
+//	CheckpointSave
+//
+//	Write a checkpoint.  Called from ExecOne (after SYNC_SIM_TIME),
+//	which passes in the state that isn't reachable through Cpu's
+//	public interface.  The file is written under a temporary name
+//	and renamed, since this run's memory may be mapped from an older
+//	copy of it.  Returns 1 on success.
+//
+//----------------------------------------------------------------------
+static
+int
+CheckpointSave (const char *file, Cpu *cpu, const uint32 *mem, uint32 msize,
+		double usElapsed, double instrsExecuted,
+		double timerInterrupt, FILE **fp)
+{
+  static CkptHeader h;
+  char		tmp[1024];
+  FILE		*f;
+  long		pagesize = sysconf (_SC_PAGESIZE);
+  int		i, ok;
+
+  memset (&h, 0, sizeof (h));
+  h.magic = DLX_CKPT_MAGIC;
+  h.version = DLX_CKPT_VERSION;
+  h.headerSize = sizeof (h);
+  h.memSize = msize;
+  h.memOffset = (sizeof (h) + swtlbEntries * sizeof (SwTlbEntry) +
+		 pagesize - 1) & ~(pagesize - 1);
+  h.pc = cpu->PC () - 4;
+  for (i = 0; i < 32; i++) {
+    h.ireg[i] = cpu->GetIreg (i);
+    h.freg[i] = cpu->GetFreg (i);
+    h.sreg[i] = cpu->GetSreg (i);
+  }
+  h.usElapsed = usElapsed;
+  h.instrsExecuted = instrsExecuted;
+  h.timerInterrupt = timerInterrupt;
+  h.idleUsSkipped = idleUsSkipped;
+  h.simInstrs = simInstrs;
+  h.swtlbEntries = swtlbEntries;
+  h.swtlbIndex = swtlbIndex;
+  h.swtlbHi = swtlbHi;
+  h.swtlbLo = swtlbLo;
+  h.swtlbNext = swtlbNext;
+  memcpy (h.dmaQueue, dmaQueue, sizeof (dmaQueue));
+  memcpy (h.dmaDone, dmaDone, sizeof (dmaDone));
+  h.dmaHead = dmaHead;
+  h.dmaCount = dmaCount;
+  h.dmaDoneHead = dmaDoneHead;
+  h.dmaDoneCount = dmaDoneCount;
+  h.dmaFinishAt = dmaFinishAt;
+  h.diskHeadCyl = diskHeadCyl;
+  for (i = 0; i < DLX_MAX_FILES; i++) {
+    if (fp[i] != NULL) {
+      fflush (fp[i]);
+      h.files[i].accessType = ckptFileModes[i];
+      h.files[i].offset = ftell (fp[i]);
+      strcpy (h.files[i].name, ckptFileNames[i]);
+    }
+  }
+  snprintf (tmp, sizeof (tmp), "%s.tmp", file);
+  if ((f = fopen (tmp, "w")) == NULL) {
+    perror (tmp);
+    return (0);
+  }
+  ok = (fwrite (&h, sizeof (h), 1, f) == 1) &&
+    (fwrite (swtlb, sizeof (SwTlbEntry), swtlbEntries, f) == swtlbEntries) &&
+    (fseek (f, h.memOffset, SEEK_SET) == 0) &&
+    (fwrite (mem, 1, msize, f) == msize);
+  if ((fclose (f) != 0) || !ok || (rename (tmp, file) < 0)) {
+    perror (file);
+    unlink (tmp);
+    return (0);
+  }
+  DBPRINTF ('t', "Checkpoint of PC=0x%x written to %s\n", h.pc, file);
+  return (1);
+}
+
+//----------------------------------------------------------------------
+//
+//	CheckpointRestore
+//
+//	Load a checkpoint written by CheckpointSave.  Returns the new guest
+//	memory (mapped copy-on-write from the file), or NULL on failure.
+//
+//----------------------------------------------------------------------
+static
+uint32 *
+CheckpointRestore (const char *file, Cpu *cpu, uint32 msize,
+		   double& usElapsed, double& instrsExecuted,
+		   double& timerInterrupt, FILE **fp)
+{
+  static CkptHeader h;
+  int		fd, i;
+  void		*mem;
+  const char	*mode;
+  long long	delta;
+
+  if ((fd = open (file, O_RDONLY)) < 0) {
+    perror (file);
+    return (NULL);
+  }
+  if ((read (fd, &h, sizeof (h)) != sizeof (h)) ||
+      (h.magic != DLX_CKPT_MAGIC) || (h.version != DLX_CKPT_VERSION) ||
+      (h.headerSize != sizeof (h)) || (h.swtlbEntries == 0)) {
+    fprintf (stderr, "%s is not a checkpoint from this simulator.\n", file);
+    close (fd);
+    return (NULL);
+  }
+  if (h.memSize != msize) {
+    fprintf (stderr, "%s was saved with %d bytes of memory, not %d.\n",
+	     file, h.memSize, msize);
+    close (fd);
+    return (NULL);
+  }
+  // The guest OS sized its TLB handling when it booted, so the count
+  // comes from the checkpoint rather than this run's environment.
+  if (h.swtlbEntries != swtlbEntries) {
+    DBPRINTF ('t', "Software TLB resized from %d to %d entries\n",
+	      swtlbEntries, h.swtlbEntries);
+    SwTlbResize (h.swtlbEntries);
+  }
+  if (read (fd, swtlb, h.swtlbEntries * sizeof (SwTlbEntry)) !=
+      (ssize_t)(h.swtlbEntries * sizeof (SwTlbEntry))) {
+    fprintf (stderr, "%s is truncated.\n", file);
+    close (fd);
+    return (NULL);
+  }
+  mem = mmap (NULL, msize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+	      h.memOffset);
+  close (fd);
+  if (mem == MAP_FAILED) {
+    perror (file);
+    return (NULL);
+  }
+  for (i = 0; i < 32; i++) {
+    cpu->PutIreg (i, h.ireg[i]);
+    cpu->PutFreg (i, h.freg[i]);
+    cpu->PutSreg (i, h.sreg[i]);
+  }
+  cpu->PutIreg (1, 1);
+  // ExecOne has already advanced the PC for this instruction.
+  cpu->SetPC (h.pc + 4);
+  usElapsed = h.usElapsed;
+  instrsExecuted = h.instrsExecuted;
+  timerInterrupt = h.timerInterrupt;
+  idleUsSkipped = h.idleUsSkipped;
+  // Deadlines set so far count from the start of this run.
+  delta = h.simInstrs - simInstrs;
+  simInstrs = syncedInstrs = h.simInstrs;
+  if (eventAt[DLX_EVENT_PROFILE] != DLX_EVENT_NEVER) {
+    eventAt[DLX_EVENT_PROFILE] += delta;
+  }
+  if (eventAt[DLX_EVENT_HEATMAP] != DLX_EVENT_NEVER) {
+    eventAt[DLX_EVENT_HEATMAP] += delta;
+  }
+  if (eventAt[DLX_EVENT_CONSOLE] != DLX_EVENT_NEVER) {
+    eventAt[DLX_EVENT_CONSOLE] += delta;
+  }
+  // Stalls are already part of the saved clock.
+  stallCycles = diskStallCycles = syncedStalls = 0;
+  CacheReset ();
+  HeatReset ();
+  mpCpus[0].llValid = 0;
+  memcpy (dmaQueue, h.dmaQueue, sizeof (dmaQueue));
+  memcpy (dmaDone, h.dmaDone, sizeof (dmaDone));
+  dmaHead = h.dmaHead;
+  dmaCount = h.dmaCount;
+  dmaDoneHead = h.dmaDoneHead;
+  dmaDoneCount = h.dmaDoneCount;
+  dmaFinishAt = h.dmaFinishAt;
+  diskHeadCyl = h.diskHeadCyl;
+  eventAt[DLX_EVENT_DISK] = (dmaDoneCount > 0) ? simInstrs + 1 : dmaFinishAt;
+  swtlbIndex = h.swtlbIndex;
+  swtlbHi = h.swtlbHi;
+  swtlbLo = h.swtlbLo;
+  swtlbNext = h.swtlbNext;
+  for (i = 0; i < DLX_MAX_FILES; i++) {
+    if (fp[i] != NULL) {
+      fclose (fp[i]);
+      fp[i] = NULL;
+    }
+    if (h.files[i].accessType == 0) {
+      continue;
+    }
+    // Files opened for writing must not be truncated a second time.
+    mode = (h.files[i].accessType == 1) ? "r" : "r+";
+    if ((fp[i] = fopen (h.files[i].name, mode)) == NULL) {
+      perror (h.files[i].name);
+      continue;
+    }
+    fseek (fp[i], h.files[i].offset, SEEK_SET);
+    strcpy (ckptFileNames[i], h.files[i].name);
+    ckptFileModes[i] = h.files[i].accessType;
+    DiskModelOpened (i, h.files[i].name);
+  }
+  PredecodeFlush ();
+  XlateFlush ();
+  BlockFlush ();
+  DBPRINTF ('t', "Restored checkpoint of PC=0x%x from %s\n", h.pc, file);
+  return ((uint32 *)mem);
+}
+
+//----------------------------------------------------------------------
+//
+//	Binary traces
+//
+//	Setting DLXSIM_TRACE_BINARY writes traces in the format described
+//	in dlxtrace.h instead of as text (set it to "lz" to compress them
+//	too).  Records are encoded into one of DLX_TRACE_NBUFS block
+//	buffers; full buffers are compressed and written by a separate
+//	thread, so the simulator only stalls if it gets a whole ring of
+//	buffers ahead of the disk.
+//
+//----------------------------------------------------------------------
+#define	DLX_TRACE_NBUFS		256	// 16MB of buffering
+#define	DLX_TRACE_MAX_RECORD	64
+#define	DLX_TRACE_LZ_HASHBITS	12
+
+static int		traceBinary;	// non-zero if writing binary traces
+static int		traceMethod;
+static FILE		*traceOut;
+static unsigned char	*traceBufs;
+static uint32		traceLens[DLX_TRACE_NBUFS];
+static int		traceHead;	// buffer being filled
+static int		traceTail;	// oldest buffer not yet written
+static int		traceCount;	// buffers waiting for the writer
+static int		traceDone;
+static unsigned char	*tracePos, *traceEnd;
+static uint32		traceLastBlock, traceLastAddr;
+static pthread_t	traceThread;
+static pthread_mutex_t	traceLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	traceCond = PTHREAD_COND_INITIALIZER;
+
+static
+inline
+void
+TracePutVarint (uint32 v)
+{
+  while (v >= 0x80) {
+    *tracePos++ = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  *tracePos++ = v;
+}
+
+static
+inline
+void
+TracePutDelta (uint32 v, uint32& last)
+{
+  int		d = (int)(v - last);
+
+  last = v;
+  TracePutVarint (((uint32)d << 1) ^ (uint32)(d >> 31));
+}
+
+static
+void
+TracePutWord (unsigned char *p, uint32 w)
+{
+  p[0] = w >> 24;
+  p[1] = w >> 16;
+  p[2] = w >> 8;
+  p[3] = w;
+}
+
+static
+uint32
+TraceLiterals (const unsigned char *in, uint32 n, unsigned char *out,
+	       uint32 o, uint32 maxout)
+{
+  uint32	chunk;
+
+  while (n > 0) {
+    chunk = (n > DLX_TRACE_LZ_MAXLIT) ? DLX_TRACE_LZ_MAXLIT : n;
+    if (o + 1 + chunk > maxout) {
+      return (maxout);
+    }
+    out[o++] = chunk - 1;
+    memcpy (out + o, in, chunk);
+    o += chunk;
+    in += chunk;
+    n -= chunk;
+  }
+  return (o);
+}
+
+//----------------------------------------------------------------------
+//
+//	TraceCompress
+//
+//	Greedy LZ compression of one block, using a hash of the next
+//	DLX_TRACE_LZ_MINMATCH bytes to find the last place they occurred.
+//	Returns the compressed length, or 0 if it didn't come out smaller
+//	(the output buffer only needs to be as big as the input).
+//
+//----------------------------------------------------------------------
+static
+uint32
+TraceCompress (const unsigned char *in, uint32 n, unsigned char *out)
+{
+  static uint32	table[1 << DLX_TRACE_LZ_HASHBITS];
+  uint32	i = 0, lit = 0, o = 0, h, cand, len;
+
+  memset (table, 0xff, sizeof (table));
+  while ((i + DLX_TRACE_LZ_MINMATCH <= n) && (o < n)) {
+    h = ((in[i] << 24) | (in[i+1] << 16) | (in[i+2] << 8) | in[i+3]);
+    h = (h * 2654435761U) >> (32 - DLX_TRACE_LZ_HASHBITS);
+    cand = table[h];
+    table[h] = i;
+    len = 0;
+    if ((cand != 0xffffffff) && (i - cand <= 0xffff)) {
+      while ((i + len < n) && (len < DLX_TRACE_LZ_MAXMATCH) &&
+	     (in[cand + len] == in[i + len])) {
+	len++;
+      }
+    }
+    if (len < DLX_TRACE_LZ_MINMATCH) {
+      i++;
+      continue;
+    }
+    o = TraceLiterals (in + lit, i - lit, out, o, n);
+    if (o + 3 > n) {
+      return (0);
+    }
+    out[o++] = 0x80 | (len - DLX_TRACE_LZ_MINMATCH);
+    out[o++] = (i - cand) >> 8;
+    out[o++] = (i - cand);
+    i += len;
+    lit = i;
+  }
+  o = TraceLiterals (in + lit, n - lit, out, o, n);
+  return ((o < n) ? o : 0);
+}
+
+static
+void *
+TraceWriter (void *arg)
+{
+  unsigned char	hdr[12];
+  unsigned char	*lzbuf = new unsigned char[DLX_TRACE_BLOCK_SIZE];
+  unsigned char	*buf;
+  uint32	len, stored;
+
+  pthread_mutex_lock (&traceLock);
+  while (1) {
+    while ((traceCount == 0) && !traceDone) {
+      pthread_cond_wait (&traceCond, &traceLock);
+    }
+    if (traceCount == 0) {
+      break;
+    }
+    buf = traceBufs + traceTail * DLX_TRACE_BLOCK_SIZE;
+    len = traceLens[traceTail];
+    pthread_mutex_unlock (&traceLock);
+    stored = 0;
+    if (traceMethod == DLX_TRACE_METHOD_LZ) {
+      stored = TraceCompress (buf, len, lzbuf);
+    }
+    TracePutWord (hdr, len);
+    TracePutWord (hdr + 4, (stored > 0) ? stored : len);
+    TracePutWord (hdr + 8, (stored > 0) ? DLX_TRACE_METHOD_LZ :
+		  DLX_TRACE_METHOD_RAW);
+    fwrite (hdr, 1, sizeof (hdr), traceOut);
+    fwrite ((stored > 0) ? lzbuf : buf, 1, (stored > 0) ? stored : len,
+	    traceOut);
+    pthread_mutex_lock (&traceLock);
+    traceTail = (traceTail + 1) % DLX_TRACE_NBUFS;
+    traceCount--;
+    pthread_cond_broadcast (&traceCond);
+  }
+  pthread_mutex_unlock (&traceLock);
+  fflush (traceOut);
+  delete [] lzbuf;
+  return (NULL);
+}
+
+//----------------------------------------------------------------------
+//
+//	TraceSubmit
+//
+//	Hand the buffer being filled to the writer and start a new one.
+//
+//----------------------------------------------------------------------
+static
+void
+TraceSubmit ()
+{
+  pthread_mutex_lock (&traceLock);
+  traceLens[traceHead] = tracePos - (traceBufs + traceHead *
+				     DLX_TRACE_BLOCK_SIZE);
+  traceCount++;
+  pthread_cond_broadcast (&traceCond);
+  traceHead = (traceHead + 1) % DLX_TRACE_NBUFS;
+  while (traceCount == DLX_TRACE_NBUFS) {
+    pthread_cond_wait (&traceCond, &traceLock);
+  }
+  pthread_mutex_unlock (&traceLock);
+  tracePos = traceBufs + traceHead * DLX_TRACE_BLOCK_SIZE;
+  traceEnd = tracePos + DLX_TRACE_BLOCK_SIZE - DLX_TRACE_MAX_RECORD;
+  traceLastBlock = traceLastAddr = 0;
+}
+
+static
+int
+TraceBinaryOpen (FILE *fp)
+{
+  const char	*mode = getenv ("DLXSIM_TRACE_BINARY");
+  unsigned char	hdr[8];
+
+  if (mode == NULL) {
+    return (0);
+  }
+  traceMethod = (strcmp (mode, "lz") == 0) ? DLX_TRACE_METHOD_LZ :
+    DLX_TRACE_METHOD_RAW;
+  traceOut = fp;
+  TracePutWord (hdr, DLX_TRACE_MAGIC);
+  TracePutWord (hdr + 4, DLX_TRACE_VERSION);
+  fwrite (hdr, 1, sizeof (hdr), traceOut);
+  traceBufs = new unsigned char[DLX_TRACE_NBUFS * DLX_TRACE_BLOCK_SIZE];
+  traceHead = traceTail = traceCount = 0;
+  tracePos = traceBufs;
+  traceEnd = tracePos + DLX_TRACE_BLOCK_SIZE - DLX_TRACE_MAX_RECORD;
+  traceLastBlock = traceLastAddr = 0;
+  if (pthread_create (&traceThread, NULL, TraceWriter, NULL) != 0) {
+    perror ("trace writer");
+    return (0);
+  }
+  traceBinary = 1;
+  return (1);
+}
+
+//----------------------------------------------------------------------
+//
+//	TraceBinaryClose
+//
+//	Write out everything that's buffered.  Must be called before the
+//	simulator exits, or the end of the trace is lost.
+//
+//----------------------------------------------------------------------
+static
+void
+TraceBinaryClose ()
+{
+  if (!traceBinary) {
+    return;
+  }
+  if (tracePos != traceBufs + traceHead * DLX_TRACE_BLOCK_SIZE) {
+    TraceSubmit ();
+  }
+  pthread_mutex_lock (&traceLock);
+  traceDone = 1;
+  pthread_cond_broadcast (&traceCond);
+  pthread_mutex_unlock (&traceLock);
+  pthread_join (traceThread, NULL);
+  traceBinary = 0;
+}
+
+static
+inline
+void
+TraceBinaryBlock (uint32 start, int ninstrs)
+{
+  if (tracePos >= traceEnd) {
+    TraceSubmit ();
+  }
+  *tracePos++ = DLX_TRACE_REC_BLOCK;
+  TracePutDelta (start, traceLastBlock);
+  TracePutVarint (ninstrs);
+}
+
+static
+inline
+void
+TraceBinaryAccess (const char *inst, int reg, uint32 addr, uint32 value)
+{
+  int		i, n;
+
+  if (tracePos >= traceEnd) {
+    TraceSubmit ();
+  }
+  for (i = 0; i < DLX_TRACE_NACCESSNAMES; i++) {
+    if (!strcmp (inst, dlxTraceAccessNames[i])) {
+      break;
+    }
+  }
+  if (i < DLX_TRACE_NACCESSNAMES) {
+    *tracePos++ = DLX_TRACE_REC_ACCESS;
+    *tracePos++ = i;
+  } else {
+    n = strlen (inst);
+    if (n > DLX_TRACE_MAX_RECORD - 20) {
+      n = DLX_TRACE_MAX_RECORD - 20;
+    }
+    *tracePos++ = DLX_TRACE_REC_ACCESS_NAME;
+    *tracePos++ = n;
+    memcpy (tracePos, inst, n);
+    tracePos += n;
+  }
+  *tracePos++ = reg;
+  TracePutDelta (addr, traceLastAddr);
+  TracePutVarint (value);
+}
+
+static
+inline
+void
+TraceBinaryEvent (int tag, uint32 a, uint32 b)
+{
+  if (tracePos >= traceEnd) {
+    TraceSubmit ();
+  }
+  *tracePos++ = tag;
+  TracePutVarint (a);
+  TracePutVarint (b);
+}
+
+//----------------------------------------------------------------------
+//
+//	PC sampling profiler
+//
+//	Setting DLXSIM_PROFILE to N samples the PC every N simulated
+//	instructions (in block mode, at the first block boundary after
+//	that).  Each sample is counted against its PC and mode, and
+//	against the page table base, which identifies the process.  Exit
+//	prints a flat profile to stderr.
+//
+//	PCs are named using the maps in DLXSIM_PROFILE_MAP (for kernel
+//	mode) and DLXSIM_PROFILE_USERMAP (for user mode).  Any line in a
+//	map that starts with a hex address and ends with a symbol name
+//	(an optional trailing colon is dropped) defines a symbol, which
+//	covers everything up to the next symbol's address.  Other lines
+//	are ignored, so assembler listings with labels work.
+//
+//----------------------------------------------------------------------
+#define	DLX_PROFILE_MAX_PROCS	64
+#define	DLX_PROFILE_TOP		40
+
+typedef struct ProfileSample {
+  uint32	pc;		// low bit set for user mode
+  uint32	count;
+} ProfileSample;
+
+typedef struct ProfileSymbol {
+  uint32	addr;
+  char		*name;
+  uint32	count;
+  int		user;		// from the user program's map
+} ProfileSymbol;
+
+typedef struct ProfileMap {
+  ProfileSymbol	*syms;
+  int		nsyms;
+} ProfileMap;
+
+static long long	profileInterval;	// 0 if not profiling
+static ProfileSample	*profileSamples;	// open hash table
+static uint32		profileSize, profileUsed;
+static uint32		profileTotal, profileUser;
+static uint32		profileProcBase[DLX_PROFILE_MAX_PROCS];
+static uint32		profileProcCount[DLX_PROFILE_MAX_PROCS];
+static int		profileNprocs;
+
+static
+void
+ProfileInit ()
+{
+  const char	*s = getenv ("DLXSIM_PROFILE");
+
+  if ((s == NULL) || ((profileInterval = atoll (s)) <= 0)) {
+    profileInterval = 0;
+    eventAt[DLX_EVENT_PROFILE] = DLX_EVENT_NEVER;
+    return;
+  }
+  profileSize = 4096;
+  profileSamples = new ProfileSample[profileSize];
+  memset (profileSamples, 0, profileSize * sizeof (ProfileSample));
+  eventAt[DLX_EVENT_PROFILE] = profileInterval;
+}
+
+static
+inline
+uint32
+ProfileHash (uint32 key, uint32 size)
+{
+  return ((key * 2654435761U) & (size - 1));
+}
+
+static
+void
+ProfileRecord (uint32 pc, int user, uint32 pgtblBase)
+{
+  uint32	key = (pc & ~0x3) | (user ? 1 : 0);
+  uint32	h, oldSize;
+  int		i;
+  ProfileSample	*old;
+
+  profileTotal++;
+  if (user) {
+    profileUser++;
+  }
+  for (i = 0; i < profileNprocs; i++) {
+    if (profileProcBase[i] == pgtblBase) {
+      break;
+    }
+  }
+  if ((i == profileNprocs) && (profileNprocs < DLX_PROFILE_MAX_PROCS)) {
+    profileProcBase[profileNprocs++] = pgtblBase;
+  }
+  if (i < profileNprocs) {
+    profileProcCount[i]++;
+  }
+  // Key 0 marks empty slots, so kernel samples at address 0 set an
+  // otherwise unused bit instead.
+  if (key == 0) {
+    key = 0x2;
+  }
+  for (h = ProfileHash (key, profileSize); profileSamples[h].pc != 0;
+       h = (h + 1) & (profileSize - 1)) {
+    if (profileSamples[h].pc == key) {
+      profileSamples[h].count++;
+      return;
+    }
+  }
+  profileSamples[h].pc = key;
+  profileSamples[h].count = 1;
+  if (++profileUsed * 2 > profileSize) {
+    old = profileSamples;
+    oldSize = profileSize;
+    profileSize *= 2;
+    profileSamples = new ProfileSample[profileSize];
+    memset (profileSamples, 0, profileSize * sizeof (ProfileSample));
+    for (i = 0; i < (int)oldSize; i++) {
+      if (old[i].pc == 0) {
+	continue;
+      }
+      for (h = ProfileHash (old[i].pc, profileSize);
+	   profileSamples[h].pc != 0; h = (h + 1) & (profileSize - 1)) {
+      }
+      profileSamples[h] = old[i];
+    }
+    delete [] old;
+  }
+}
+
+static
+int
+ProfileCompareAddr (const void *a, const void *b)
+{
+  uint32	x = ((const ProfileSymbol *)a)->addr;
+  uint32	y = ((const ProfileSymbol *)b)->addr;
+
+  return ((x < y) ? -1 : (x > y));
+}
+
+static
+int
+ProfileCompareCount (const void *a, const void *b)
+{
+  uint32	x = (*(const ProfileSymbol **)a)->count;
+  uint32	y = (*(const ProfileSymbol **)b)->count;
+
+  return ((x > y) ? -1 : (x < y));
+}
+
+//----------------------------------------------------------------------
+//
+//	ProfileLoadMap
+//
+//	Read the symbols from a map file (see above) and sort them.
+//
+//----------------------------------------------------------------------
+static
+void
+ProfileLoadMap (const char *file, int user, ProfileMap *map)
+{
+  FILE		*fp;
+  char		line[300];
+  char		*pos, *end, *name;
+  uint32	addr;
+  int		max = 256;
+
+  map->nsyms = 0;
+  map->syms = NULL;
+  if ((file == NULL) || ((fp = fopen (file, "r")) == NULL)) {
+    return;
+  }
+  map->syms = (ProfileSymbol *)malloc (max * sizeof (ProfileSymbol));
+  while (fgets (line, sizeof (line), fp) != NULL) {
+    addr = strtoul (line, &pos, 16);
+    if ((pos == line) || !isspace (*pos)) {
+      continue;
+    }
+    // The symbol is the last word on the line.
+    for (end = pos + strlen (pos); (end > pos) && isspace (end[-1]); end--) {
+    }
+    if ((end > pos) && (end[-1] == ':')) {
+      end--;
+    }
+    for (name = end; (name > pos) && (isalnum (name[-1]) ||
+				       (name[-1] == '_') ||
+				       (name[-1] == '.')); name--) {
+    }
+    if ((name == end) || isdigit (*name) ||
+	((name > pos) && !isspace (name[-1]))) {
+      continue;
+    }
+    if (map->nsyms == max) {
+      max *= 2;
+      map->syms = (ProfileSymbol *)realloc (map->syms,
+					    max * sizeof (ProfileSymbol));
+    }
+    map->syms[map->nsyms].addr = addr;
+    map->syms[map->nsyms].name = strndup (name, end - name);
+    map->syms[map->nsyms].count = 0;
+    map->syms[map->nsyms].user = user;
+    map->nsyms++;
+  }
+  fclose (fp);
+  qsort (map->syms, map->nsyms, sizeof (ProfileSymbol), ProfileCompareAddr);
+}
 
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->ReadWord (addr & 0xfffffffc, val)) {
+static
+ProfileSymbol *
+ProfileLookup (ProfileMap *map, uint32 pc)
+{
+  int		lo = 0, hi = map->nsyms - 1, mid;
+
+  if ((hi < 0) || (pc < map->syms[0].addr)) {
+    return (NULL);
+  }
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (map->syms[mid].addr <= pc) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return (&map->syms[lo]);
+}
+
+//----------------------------------------------------------------------
+//
+//	ProfileReport
+//
+//	Print the flat profile.  Samples at PCs with no symbol are added
+//	up as "(kernel)" or "(user)".
+//
+//----------------------------------------------------------------------
+static
+void
+ProfileReport ()
+{
+  ProfileMap	maps[2];
+  ProfileSymbol	unknown[2];
+  ProfileSymbol	*sym, **sorted;
+  int		i, j, n, user;
+
+  if (profileInterval == 0) {
+    return;
+  }
+  if (profileTotal == 0) {
+    // The run was shorter than one interval.
+    fprintf (stderr, "Profile: no samples taken.\n");
+    return;
+  }
+  ProfileLoadMap (getenv ("DLXSIM_PROFILE_MAP"), 0, &maps[0]);
+  ProfileLoadMap (getenv ("DLXSIM_PROFILE_USERMAP"), 1, &maps[1]);
+  unknown[0].name = (char *)"(kernel)";
+  unknown[1].name = (char *)"(user)";
+  unknown[0].count = unknown[1].count = 0;
+  unknown[0].user = 0;
+  unknown[1].user = 1;
+  for (i = 0; i < (int)profileSize; i++) {
+    if (profileSamples[i].pc == 0) {
+      continue;
+    }
+    user = profileSamples[i].pc & 0x1;
+    if ((sym = ProfileLookup (&maps[user],
+			      profileSamples[i].pc & ~0x3)) == NULL) {
+      sym = &unknown[user];
+    }
+    sym->count += profileSamples[i].count;
+  }
+  n = 0;
+  sorted = new ProfileSymbol *[maps[0].nsyms + maps[1].nsyms + 2];
+  for (user = 0; user < 2; user++) {
+    for (j = 0; j < maps[user].nsyms; j++) {
+      if (maps[user].syms[j].count > 0) {
+	sorted[n++] = &maps[user].syms[j];
+      }
+    }
+    if (unknown[user].count > 0) {
+      sorted[n++] = &unknown[user];
+    }
+  }
+  qsort (sorted, n, sizeof (ProfileSymbol *), ProfileCompareCount);
+  fprintf (stderr, "Profile: %u samples every %lld instructions, "
+	   "%.1f%% user, %.1f%% kernel\n", profileTotal, profileInterval,
+	   100.0 * profileUser / profileTotal,
+	   100.0 * (profileTotal - profileUser) / profileTotal);
+  fprintf (stderr, "  %%time  samples  symbol\n");
+  for (i = 0; (i < n) && (i < DLX_PROFILE_TOP); i++) {
+    fprintf (stderr, "%7.2f %8u  %s%s\n",
+	     100.0 * sorted[i]->count / profileTotal, sorted[i]->count,
+	     sorted[i]->name, sorted[i]->user ? " [user]" : "");
+  }
+  fprintf (stderr, "  %%time  samples  page table base\n");
+  for (i = 0; i < profileNprocs; i++) {
+    fprintf (stderr, "%7.2f %8u  0x%08x\n",
+	     100.0 * profileProcCount[i] / profileTotal, profileProcCount[i],
+	     profileProcBase[i]);
+  }
+  delete [] sorted;
+}
+
+//----------------------------------------------------------------------
+//
+//	Cpu::Cpu
+//
+//	Create a new CPU.
+//
+//----------------------------------------------------------------------
+Cpu::Cpu (int msize)
+{
+  int		i;
+  struct timeval t;
+
+  flags = 0;
+  usElapsed = 0.0;
+  instrsExecuted = 0.0;
+  usPerInst = 1.0;
+  for (i = 0; i < 32; i++) {
+    sreg[i] = 0;
+    ireg[i] = 0;
+    freg[i] = 0;
+  }
+  SetStatusBit (DLX_STATUS_PAGE_TABLE);
+  SetStatusBit (DLX_STATUS_SYSMODE);
+  EnableInterrupts ();
+  timerInterrupt = DLX_TIMER_NOT_ACTIVE;
+  memSize = msize;
+  memory = new uint32[msize/sizeof(uint32)];
+  bulkMemory = (unsigned char *)memory;
+  bulkMemSize = msize;
+  PredecodeFlush ();
+  SwTlbInit ();
+  xlatePteWordsSize = (msize / sizeof(uint32) + 7) / 8;
+  xlatePteWords = new unsigned char[xlatePteWordsSize];
+  XlateFlush ();
+  if ((getenv ("DLXSIM_PTE_AD") != NULL) &&
+      !strcmp (getenv ("DLXSIM_PTE_AD"), "off")) {
+    xlateAdMask = 0;
+  }
+  BlockInit (msize);
+  MpInit (this);
+  if (mpCount > 1) {
+    blockExec = 0;
+  }
+  basicBlockStart = 1;	// basic block can never start at address 1!
+  // Initialize the keyboard I/O stuff.
+  kbdbufferedchars = 0;
+  kbdrpos = kbdwpos = 0;
+  kbdcounter = 0;
+  // The keyboard is polled every DLX_KBD_FREQUENCY+2 instructions,
+  // unless input comes from a thread or is turned off.
+  KbdInit ();
+  eventAt[DLX_EVENT_KBD] = (kbdMode == DLX_KBD_POLL) ?
+    DLX_KBD_FREQUENCY + 2 : DLX_EVENT_NEVER;
+  // A checkpoint is restored by the first event check, once main has
+  // finished setting up the CPU.
+  ckptRestoreFile = getenv ("DLXSIM_RESTORE");
+  eventAt[DLX_EVENT_CKPT] = (ckptRestoreFile != NULL) ? 0 : DLX_EVENT_NEVER;
+  ProfileInit ();
+  CacheInit ();
+  DiskModelInit ();
+  DmaInit ();
+  StatsInit ();
+  HeatInit (msize);
+  ConsoleInit ();
+  EventsTimerDeadline (usElapsed, timerInterrupt, usPerInst);
+  SetupRawIo ();
+  //Zheng, add (timezone *)
+  //gettimeofday (&t, (timezone*)(void *)0);
+  gettimeofday (&t, (void *)0);
+  realElapsed = (double)t.tv_sec + ((double)t.tv_usec) * 1e-6;
+}
+
+//----------------------------------------------------------------------
+//
+//	TraceFile
+//
+//	Open the passed file name for tracing.  If the file is NULL,
+//	open stdout.
+//
+//----------------------------------------------------------------------
+int
+Cpu::TraceFile (char *name)
+{
+  if ((name == NULL) || (!strcmp (name, "-"))) {
+    tracefp = stdout;
+    TraceBinaryOpen (tracefp);
+    return (1);
+  } else if ((tracefp = fopen (name, "w")) == NULL) {
     return (0);
   }
-  val >>= shiftcount[addr & 0x3];
-  val &= 0xff;
-  DBPRINTF ('l',"Loading unsigned byte 0x%02x from location 0x%x.\n",val,addr);
-  cpu->TraceAccess("lbu", dst, addr, val);
-  cpu->PutIreg (dst, val);
+  TraceBinaryOpen (tracefp);
+  return (1);
+}
+
+//----------------------------------------------------------------------
+//
+//	Instruction parsing functions
+//
+//	These functions take an instruction and return the relevant fields.
+//
+//----------------------------------------------------------------------
+inline
+void
+Cpu::GetRFields (uint32 inst, uint32& src1, uint32& src2, uint32& dst)
+{
+  src1 = (inst >> DLX_RFMT_SRC1_SHIFT) & DLX_REG_MASK;
+  src2 = (inst >> DLX_RFMT_SRC2_SHIFT) & DLX_REG_MASK;
+  dst = (inst >> DLX_RFMT_DST_SHIFT) & DLX_REG_MASK;
+}
+
+inline
+void
+Cpu::GetIFields (uint32 inst, uint32& src, uint32& imm, uint32& dst)
+{
+  src = (inst >> DLX_IFMT_SRC_SHIFT) & DLX_REG_MASK;
+  dst = (inst >> DLX_IFMT_DST_SHIFT) & DLX_REG_MASK;
+  imm = (inst >> DLX_IFMT_IMM_SHIFT) & 0xffff;
+}
+
+inline
+void
+Cpu::GetJFields (uint32 inst, uint32& jaddr)
+{
+  jaddr = inst & 0x1ffffff;
+  if (jaddr & 0x1000000) {
+    jaddr |= 0xfe000000;
+  }
+}
+
+inline
+void
+Cpu::SignExtend16 (uint32& v)
+{
+  if (v & 0x8000) {
+    v |= 0xffff0000;
+  }
+}
+
+inline
+void
+Cpu::SignExtend8 (uint32& v)
+{
+  if (v & 0x80) {
+    v |= 0xffffff00;
+  }
+}
+
+//----------------------------------------------------------------------
+//
+//	Cpu::Jump
+//
+//	Jump to a particular location after dealing with the delay
+//	slot.  Checks to ensure that the jump address could be valid
+//	(ie, is on a word boundary).  It doesn't check to ensure that
+//	the jump destination is valid; that's done on the first instruction
+//	fetch to follow.
+//
+//----------------------------------------------------------------------
+inline
+int
+Cpu::Jump (uint32 jmpDst)
+{
+  if ((jmpDst & 0x3) == 0) {
+    DBPRINTF ('j', "Jump from 0x%x to 0x%x.\n", PC(), jmpDst);
+    OutputBasicBlock (jmpDst);
+    SetPC (jmpDst);
+  } else {
+    CauseException (DLX_EXC_ADDRESS);
+  }
   return (1);
 }
+
 
 //----------------------------------------------------------------------
 //
-//	Store instructions
+//	Instruction functions
+//
+//	These functions implement individual instructions.  They return
+//	the number of instructions executed, which will either be 1 if the
+//	instruction completed successfully or 0 if the instruction caused
+//	an exception.
+//
+//	Since the instructions are pretty simple (and similar), they won't
+//	be documented extensively except for the more complex ones.
+//----------------------------------------------------------------------
+
+//----------------------------------------------------------------------
+//
+//	Integer ALU instructions
+//
+//	The R-R and immediate ALU instructions differ only in the
+//	operation, where the second operand comes from, and whether they
+//	check for overflow, so their handlers are generated from
+//	DLX_ALU_INSTRS rather than written out one by one.  Each line of
+//	the table names a handler and gives its operation (one of
+//	DLX_ALU_OPS), operand format and overflow check.  AluInst is
+//	instantiated once per line, so the format and overflow tests are
+//	resolved at compile time and the operation is inlined: each
+//	handler does just the arithmetic it needs on the operand fields
+//	of a DecodedInst.  Every line yields two functions: name##Decoded,
+//	which ExecOne calls with the predecoded entry, and name, which
+//	takes the raw word, decodes it into a local entry and calls the
+//	first.  The second keeps the old name, so the instruction tables
+//	are unchanged.  The loads and stores, jumps and branches, and FP
+//	compares further down are generated the same way from their own
+//	tables.
+//
+//----------------------------------------------------------------------
+#define	DLX_ALU_RR		0	// second operand is a register
+#define	DLX_ALU_IMM		1	// 16-bit immediate, zero extended
+#define	DLX_ALU_SIMM		2	// 16-bit immediate, sign extended
+
+#define	DLX_ALU_NO_OVF		0
+#define	DLX_ALU_OVF_ADD		1
+#define	DLX_ALU_OVF_SUB		2
+
+// Operations, as expressions of the operands v1 and v2.  Shift counts
+// only use the low 5 bits.
+#define	DLX_ALU_OPS(X)							\
+  X (Add,	v1 + v2)						\
+  X (Sub,	v1 - v2)						\
+  X (And,	v1 & v2)						\
+  X (Or,	v1 | v2)						\
+  X (Xor,	v1 ^ v2)						\
+  X (Sll,	v1 << (v2 & 0x1f))					\
+  X (Srl,	v1 >> (v2 & 0x1f))					\
+  X (Sra,	(uint32)((int)v1 >> (v2 & 0x1f)))			\
+  X (Lhi,	v2 << 16)						\
+  X (Seq,	(v1 == v2) ? 1 : 0)					\
+  X (Sne,	(v1 != v2) ? 1 : 0)					\
+  X (Slt,	((int)v1 < (int)v2) ? 1 : 0)				\
+  X (Sgt,	((int)v1 > (int)v2) ? 1 : 0)				\
+  X (Sle,	((int)v1 <= (int)v2) ? 1 : 0)				\
+  X (Sge,	((int)v1 >= (int)v2) ? 1 : 0)
+
+//	handler		op	format		overflow
+#define	DLX_ALU_INSTRS(X)						\
+  X (InstAdd,	Add,	DLX_ALU_RR,	DLX_ALU_OVF_ADD)		\
+  X (InstAddu,	Add,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSub,	Sub,	DLX_ALU_RR,	DLX_ALU_OVF_SUB)		\
+  X (InstSubu,	Sub,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstAnd,	And,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstOr,	Or,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstXor,	Xor,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSll,	Sll,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSrl,	Srl,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSra,	Sra,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSeq,	Seq,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSne,	Sne,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSlt,	Slt,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSgt,	Sgt,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSle,	Sle,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstSge,	Sge,	DLX_ALU_RR,	DLX_ALU_NO_OVF)			\
+  X (InstAddi,	Add,	DLX_ALU_SIMM,	DLX_ALU_OVF_ADD)		\
+  X (InstAddui,	Add,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstSubi,	Sub,	DLX_ALU_SIMM,	DLX_ALU_OVF_SUB)		\
+  X (InstSubui,	Sub,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstAndi,	And,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstOri,	Or,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstXori,	Xor,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstSlli,	Sll,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstSrli,	Srl,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstSrai,	Sra,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstLhi,	Lhi,	DLX_ALU_IMM,	DLX_ALU_NO_OVF)			\
+  X (InstSeqi,	Seq,	DLX_ALU_SIMM,	DLX_ALU_NO_OVF)			\
+  X (InstSnei,	Sne,	DLX_ALU_SIMM,	DLX_ALU_NO_OVF)			\
+  X (InstSlti,	Slt,	DLX_ALU_SIMM,	DLX_ALU_NO_OVF)			\
+  X (InstSgti,	Sgt,	DLX_ALU_SIMM,	DLX_ALU_NO_OVF)			\
+  X (InstSlei,	Sle,	DLX_ALU_SIMM,	DLX_ALU_NO_OVF)			\
+  X (InstSgei,	Sge,	DLX_ALU_SIMM,	DLX_ALU_NO_OVF)
+
+#define	DLX_ALU_OP_STRUCT(name, expr)					\
+  struct AluOp##name {							\
+    static inline uint32 Do (uint32 v1, uint32 v2) { return (expr); }	\
+  };
+
+DLX_ALU_OPS (DLX_ALU_OP_STRUCT)
+
+template <class Op, int Format, int Overflow>
+static
+inline
+int
+AluInst (const DecodedInst *d, Cpu *cpu)
+{
+  uint32	dst;
+  uint32	v1, v2, result;
+
+  if (Format == DLX_ALU_RR) {
+    v2 = cpu->GetIreg(d->src2);
+    dst = d->dst;
+  } else {
+    v2 = (Format == DLX_ALU_SIMM) ? d->simm : d->imm;
+    dst = d->src2;
+  }
+  v1 = cpu->GetIreg(d->src1);
+  result = Op::Do (v1, v2);
+  cpu->PutIreg (dst, result);
+  // Overflow if the operands (for a subtract, the first operand and
+  // the negated second one) have the same sign and the result doesn't.
+  // The instruction isn't redone after the exception.
+  if ((Overflow == DLX_ALU_OVF_ADD) &&
+      (((v1 & 0x80000000) == (v2 & 0x80000000)) &&
+       ((v1 & 0x80000000) != (result & 0x80000000)))) {
+    cpu->CauseException (DLX_EXC_OVERFLOW);
+  } else if ((Overflow == DLX_ALU_OVF_SUB) &&
+	     (((v1 & 0x80000000) != (v2 & 0x80000000)) &&
+	      ((v1 & 0x80000000) != (result & 0x80000000)))) {
+    cpu->CauseException (DLX_EXC_OVERFLOW);
+  }
+  return (1);
+}
+
+// The raw-word form of a generated handler, for the instruction
+// tables: decode into a local entry and call the decoded form.
+#define	DLX_RAW_HANDLER(name)						\
+  static int								\
+  name (uint32 inst, Cpu *cpu)						\
+  {									\
+    DecodedInst	d;							\
+									\
+    DecodeFields (&d, inst);						\
+    return (name##Decoded (&d, cpu));					\
+  }
+
+#define	DLX_ALU_HANDLER(name, op, format, overflow)			\
+  static int								\
+  name##Decoded (const DecodedInst *d, Cpu *cpu)			\
+  {									\
+    return (AluInst<AluOp##op, format, overflow> (d, cpu));		\
+  }									\
+  DLX_RAW_HANDLER (name)
+
+DLX_ALU_INSTRS (DLX_ALU_HANDLER)
+
+//----------------------------------------------------------------------
+//
+//	Sub-word accesses
+//
+//	Byte and halfword loads and stores call SubwordAccess with one of
+//	the ops below (for a store, val holds the value to store).  The
+//	word containing the address is translated once, with the same
+//	checks and faults as a word access.  A load reads that word with
+//	ReadWord and picks the bytes out of it.  A store asks ReadWord
+//	only for the physical address (DLX_MEM_PADDR_STORE, which reads
+//	nothing) and writes the bytes in place.  Guest memory is kept in
+//	DLX (big-endian) byte order, so byte n of a word is at
+//	bulkMemory + paddr + n.  The caller checks halfword alignment.  I/O
+//	registers are only word wide, so sub-word stores to I/O space
+//	read and write back whole words.
+//
+//----------------------------------------------------------------------
+#define	DLX_MEM_LOAD_BYTE	0x100
+#define	DLX_MEM_LOAD_HALF	0x101
+#define	DLX_MEM_STORE_BYTE	0x102
+#define	DLX_MEM_STORE_HALF	0x103
+
+#define	DLX_MEM_SUBWORD_HALF	0x1	// set in the halfword ops
+#define	DLX_MEM_SUBWORD_STORE	0x2	// set in the store ops
+
+// ReadWord ops: translate for a store or a load and return the
+// physical address.
+#define	DLX_MEM_PADDR		0x200
+#define	DLX_MEM_PADDR_STORE	(DLX_MEM_PADDR | DLX_MEM_WRITE)
+#define	DLX_MEM_PADDR_LOAD	(DLX_MEM_PADDR | DLX_MEM_READ)
+
+static
+int
+SubwordAccess (Cpu *cpu, uint32 vaddr, uint32 &val, uint32 op)
+{
+  uint32	paddr, word, shift, mask;
+  unsigned char	*b;
+
+  shift = (op & DLX_MEM_SUBWORD_HALF) ? (16 - 8 * (vaddr & 0x2)) :
+    (24 - 8 * (vaddr & 0x3));
+  mask = (op & DLX_MEM_SUBWORD_HALF) ? 0xffff : 0xff;
+  if (!(op & DLX_MEM_SUBWORD_STORE)) {
+    if (!cpu->ReadWord (vaddr & ~0x3, word)) {
+      return (0);
+    }
+    val = (word >> shift) & mask;
+    return (1);
+  }
+  if (!cpu->ReadWord (vaddr & ~0x3, paddr, DLX_MEM_PADDR_STORE)) {
+    return (0);
+  }
+  if ((paddr >= bulkMemSize) || (bulkMemSize - paddr < 4)) {
+    if (!cpu->ReadWord (vaddr & ~0x3, word)) {
+      return (0);
+    }
+    return (cpu->WriteWord (vaddr & ~0x3, (word & ~(mask << shift)) |
+			    ((val & mask) << shift)));
+  }
+  b = bulkMemory + paddr + (vaddr & 0x3);
+  if (op & DLX_MEM_SUBWORD_HALF) {
+    b[0] = (val >> 8) & 0xff;
+    b[1] = val & 0xff;
+  } else {
+    b[0] = val & 0xff;
+  }
+  perfStores++;
+  MemoryWritten (paddr);
+  if (cacheModel) {
+    CacheAccess (&cacheL1D, paddr, cpu->UserMode ());
+  }
+  if (heatPages != NULL) {
+    HeatCount (paddr, DLX_HEAT_WRITES, cpu->UserMode (),
+	       cpu->GetSreg (DLX_SREG_PGTBL_BASE));
+  }
+  return (1);
+}
+
+//----------------------------------------------------------------------
+//
+//	Load and store instructions
+//
+//	Word, halfword and byte loads and stores, and the single-word FP
+//	ones, are generated like the ALU handlers, from DLX_LOAD_INSTRS
+//	and DLX_STORE_INSTRS.  Each line gives the handler, the name it's
+//	traced under, the access width, whether a load sign extends, and
+//	which register file the value comes from or goes to.  Word
+//	accesses go to ReadWord and WriteWord, the others to
+//	SubwordAccess.  ll, sc, ld and sd are written out below: they
+//	keep a reservation or do two accesses.
 //
 //----------------------------------------------------------------------
+#define	DLX_LS_WORD		0
+#define	DLX_LS_HALF		1
+#define	DLX_LS_BYTE		2
+
+#define	DLX_LS_UNSIGNED		0
+#define	DLX_LS_SIGNED		1
+
+#define	DLX_LS_IREG		0
+#define	DLX_LS_FREG		1
+
+//	handler		trace	width		extend		registers
+#define	DLX_LOAD_INSTRS(X)						\
+  X (InstLw,	"lw",	DLX_LS_WORD,	DLX_LS_UNSIGNED, DLX_LS_IREG)	\
+  X (InstLh,	"lh",	DLX_LS_HALF,	DLX_LS_SIGNED,	DLX_LS_IREG)	\
+  X (InstLhu,	"lhu",	DLX_LS_HALF,	DLX_LS_UNSIGNED, DLX_LS_IREG)	\
+  X (InstLb,	"lb",	DLX_LS_BYTE,	DLX_LS_SIGNED,	DLX_LS_IREG)	\
+  X (InstLbu,	"lbu",	DLX_LS_BYTE,	DLX_LS_UNSIGNED, DLX_LS_IREG)	\
+  X (InstLf,	"lf",	DLX_LS_WORD,	DLX_LS_UNSIGNED, DLX_LS_FREG)
+
+//	handler		trace	width		registers
+#define	DLX_STORE_INSTRS(X)						\
+  X (InstSw,	"sw",	DLX_LS_WORD,	DLX_LS_IREG)			\
+  X (InstSh,	"sh",	DLX_LS_HALF,	DLX_LS_IREG)			\
+  X (InstSb,	"sb",	DLX_LS_BYTE,	DLX_LS_IREG)			\
+  X (InstSf,	"sf",	DLX_LS_WORD,	DLX_LS_FREG)
+
+template <int Width, int Extend, int Regs>
+static
+inline
+int
+LoadInst (const DecodedInst *d, Cpu *cpu, const char *trace)
+{
+  uint32	addr, val;
+
+  addr = cpu->EffectiveAddress (d->src1, d->imm);
+  // Half-word accesses must be 2-byte aligned
+  if ((Width == DLX_LS_HALF) && ((addr & 0x1) == 1)) {
+    cpu->CauseException (DLX_EXC_ADDRESS);
+    return (0);
+  }
+  // If access fails, this instruction isn't considered completed
+  if (Width == DLX_LS_WORD) {
+    if (! cpu->ReadWord (addr, val)) {
+      return (0);
+    }
+  } else if (! SubwordAccess (cpu, addr, val, (Width == DLX_LS_HALF) ?
+			      DLX_MEM_LOAD_HALF : DLX_MEM_LOAD_BYTE)) {
+    return (0);
+  }
+  DBPRINTF ('l', "Loading %s 0x%x from location 0x%x.\n", trace, val, addr);
+  cpu->TraceAccess (trace, d->src2, addr, val);
+  if ((Extend == DLX_LS_SIGNED) && (Width == DLX_LS_HALF)) {
+    cpu->SignExtend16 (val);
+  } else if ((Extend == DLX_LS_SIGNED) && (Width == DLX_LS_BYTE)) {
+    cpu->SignExtend8 (val);
+  }
+  if (Regs == DLX_LS_FREG) {
+    cpu->PutFreg (d->src2, val);
+  } else {
+    cpu->PutIreg (d->src2, val);
+  }
+  return (1);
+}
+
+template <int Width, int Regs>
 static
+inline
 int
-InstSh (uint32 inst, Cpu *cpu)
+StoreInst (const DecodedInst *d, Cpu *cpu, const char *trace)
 {
-  uint32	addrReg, offset, dst, addr, val, kval, regval, shiftamt;
-  static int	shiftcount[4] = {16, 16, 0, 0};
+  uint32	addr, val;
 
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  // If access fails, this instruction isn't considered completed
-  // ReadWord checks for misaligned accesses.
-  if (! cpu->ReadWord (addr & 0xfffffffe, val)) {
+  addr = cpu->EffectiveAddress (d->src1, d->imm);
+  // Half-word accesses must be 2-byte aligned
+  if ((Width == DLX_LS_HALF) && ((addr & 0x1) == 1)) {
+    cpu->CauseException (DLX_EXC_ADDRESS);
     return (0);
   }
-  kval = val;
-  shiftamt = shiftcount[addr & 0x3];
-  regval = (cpu->GetIreg (dst) & 0xffff);
-  val &= ~(0xffff << shiftamt);
-  val |= regval << shiftamt;
-  DBPRINTF ('s',"Storing half 0x%04x (0x%08x -> 0x%08x) to location 0x%x.\n",
-	    regval, kval, val, addr);
-  // This should never fail (if ReadWord worked), but just in case...
-  if (! cpu->WriteWord (addr & 0xfffffffc, val)) {
+  val = (Regs == DLX_LS_FREG) ? cpu->GetFreg (d->src2) :
+    cpu->GetIreg (d->src2);
+  if (Width == DLX_LS_HALF) {
+    val &= 0xffff;
+  } else if (Width == DLX_LS_BYTE) {
+    val &= 0xff;
+  }
+  DBPRINTF ('s', "Storing %s 0x%x to location 0x%x.\n", trace, val, addr);
+  // If access fails, this instruction isn't considered completed
+  if (Width == DLX_LS_WORD) {
+    if (! cpu->WriteWord (addr, val)) {
+      return (0);
+    }
+  } else if (! SubwordAccess (cpu, addr, val, (Width == DLX_LS_HALF) ?
+			      DLX_MEM_STORE_HALF : DLX_MEM_STORE_BYTE)) {
     return (0);
   }
-  cpu->TraceAccess("sh", dst, addr, regval);
+  cpu->TraceAccess (trace, d->src2, addr, val);
   return (1);
 }
 
+#define	DLX_LOAD_HANDLER(name, trace, width, extend, regs)		\
+  static int								\
+  name##Decoded (const DecodedInst *d, Cpu *cpu)			\
+  {									\
+    return (LoadInst<width, extend, regs> (d, cpu, trace));		\
+  }									\
+  DLX_RAW_HANDLER (name)
+
+#define	DLX_STORE_HANDLER(name, trace, width, regs)			\
+  static int								\
+  name##Decoded (const DecodedInst *d, Cpu *cpu)			\
+  {									\
+    return (StoreInst<width, regs> (d, cpu, trace));			\
+  }									\
+  DLX_RAW_HANDLER (name)
+
+DLX_LOAD_INSTRS (DLX_LOAD_HANDLER)
+DLX_STORE_INSTRS (DLX_STORE_HANDLER)
+
+//----------------------------------------------------------------------
+//
+//	Load-linked and store-conditional
+//
+//----------------------------------------------------------------------
 static
 int
-InstSb (uint32 inst, Cpu *cpu)
+InstLl (uint32 inst, Cpu *cpu)
 {
-  uint32	addrReg, offset, dst, addr, val, kval, regval, shiftamt;
-  static int	shiftcount[4] = {24, 16, 8, 0};
+  uint32	addrReg, offset, dst, addr, val, paddr;
 
   cpu->GetIFields (inst, addrReg, offset, dst);
   addr = cpu->EffectiveAddress (addrReg, offset);
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->ReadWord (addr & 0xfffffffc, val)) {
+  if (! cpu->ReadWord (addr, val)) {
     return (0);
   }
-  kval = val;
-  shiftamt = shiftcount[addr & 0x3];
-  regval = (cpu->GetIreg (dst) & 0xff);
-  val &= ~(0xff << shiftamt);
-  val |= regval << shiftamt;
-  DBPRINTF ('s',"Storing byte 0x%02x (0x%08x -> 0x%08x) to location 0x%x.\n",
-	    regval, kval, val, addr);
-  // This should never fail (if ReadWord worked), but just in case...
-  if (! cpu->WriteWord (addr & 0xfffffffc, val)) {
-    return (0);
+  DBPRINTF ('l', "Load-linked word 0x%08x from location 0x%x.\n", val, addr);
+  // The word was just read, so getting its physical address can't
+  // fault.
+  if (cpu->ReadWord (addr, paddr, DLX_MEM_PADDR_LOAD)) {
+    mpCur->llValid = llAny = 1;
+    mpCur->llAddr = addr;
+    mpCur->llSpace = cpu->GetSreg (DLX_SREG_PGTBL_BASE);
+    mpCur->llPaddr = paddr;
   }
-  cpu->TraceAccess("sb", dst, addr, regval);
+  cpu->TraceAccess("ll", dst, addr, val);
+  cpu->PutIreg (dst, val);
   return (1);
 }
 
 static
 int
-InstSw (uint32 inst, Cpu *cpu)
+InstSc (uint32 inst, Cpu *cpu)
 {
   uint32	addrReg, offset, dst, addr, val;
 
   cpu->GetIFields (inst, addrReg, offset, dst);
   addr = cpu->EffectiveAddress (addrReg, offset);
   val = cpu->GetIreg (dst);
-  DBPRINTF ('s',"Storing word 0x%08x to location 0x%x.\n", val, addr);
-  // If access fails, this instruction isn't considered completed
+  if (!mpCur->llValid || (mpCur->llAddr != addr) ||
+      (mpCur->llSpace != cpu->GetSreg (DLX_SREG_PGTBL_BASE))) {
+    DBPRINTF ('s', "Store-conditional to 0x%x failed.\n", addr);
+    mpCur->llValid = 0;
+    cpu->PutIreg (dst, 0);
+    return (1);
+  }
+  // If the store faults, the exception drops the reservation, so the
+  // retried sc fails and the caller starts over with ll.  The store
+  // itself drops every reservation on the word, this one included.
   if (! cpu->WriteWord (addr, val)) {
     return (0);
   }
-  cpu->TraceAccess("sw", dst, addr, val);
+  DBPRINTF ('s', "Store-conditional of 0x%08x to 0x%x.\n", val, addr);
+  cpu->TraceAccess("sc", dst, addr, val);
+  cpu->PutIreg (dst, 1);
   return (1);
 }
 
 //----------------------------------------------------------------------
 //
-//	FP load/store instructions
+//	Double precision FP load/store instructions
 //
 //----------------------------------------------------------------------
-static
-int
-InstLf (uint32 inst, Cpu *cpu)
-{
-  uint32	addrReg, offset, dst, addr, val;
-
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->ReadWord (addr, val)) {
-    return (0);
-  }
-  cpu->PutFreg (dst, val);
-  cpu->TraceAccess("lf", dst, addr, val);
-  return (1);
-}
-
 static
 int
 InstLd (uint32 inst, Cpu *cpu)
@@ -917,23 +3828,6 @@ InstLd (uint32 inst, Cpu *cpu)
   return (1);
 }
 
-static
-int
-InstSf (uint32 inst, Cpu *cpu)
-{
-  uint32	addrReg, offset, dst, addr, val;
-
-  cpu->GetIFields (inst, addrReg, offset, dst);
-  addr = cpu->EffectiveAddress (addrReg, offset);
-  val = cpu->GetFreg (dst);
-  // If access fails, this instruction isn't considered completed
-  if (! cpu->WriteWord (addr, val)) {
-    return (0);
-  }
-  cpu->TraceAccess("sf", dst, addr, val);
-  return (1);
-}
-
 static
 int
 InstSd (uint32 inst, Cpu *cpu)
@@ -1021,118 +3915,78 @@ InstMovi2fp (uint32 inst, Cpu *cpu)
 
 //----------------------------------------------------------------------
 //
-//	Unconditional jumps & subroutine calls
-//
-//----------------------------------------------------------------------
-static
-int
-InstJmp (uint32 inst, Cpu *cpu)
-{
-  uint32	joffset;
-
-  cpu->GetJFields (inst, joffset);
-  return (cpu->Jump (cpu->PC() + (int)joffset));
-}
-
-static
-int
-InstJr (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  return (cpu->Jump (cpu->GetIreg(src1)));
-}
-
-static
-int
-InstJal (uint32 inst, Cpu *cpu)
-{
-  uint32	joffset;
-
-  cpu->GetJFields (inst, joffset);
-  cpu->PutIreg (31, cpu->PC());
-  DBPRINTF ('j', "jal from 0x%x to 0x%x.\n", cpu->PC(),
-	    cpu->PC() + (int)joffset);
-  return (cpu->Jump (cpu->PC() + (int)joffset));
-}
-
-static
-int
-InstJalr (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutIreg (31, cpu->PC());
-  return (cpu->Jump (cpu->GetIreg(src1)));
-}
-
-//----------------------------------------------------------------------
+//	Jumps and branches
 //
-//	Conditional branches
+//	Generated like the ALU handlers, from DLX_BRANCH_INSTRS.  Each
+//	line gives the handler, the condition it's taken on, where the
+//	target comes from, and whether it saves the return address in
+//	r31.  The PC has already been advanced, so offsets are from the
+//	next instruction.  The link is written before a register target
+//	is read, so jalr r31 goes to the next instruction.
 //
 //----------------------------------------------------------------------
+#define	DLX_BR_ALWAYS		0
+#define	DLX_BR_ZERO		1	// first source register is zero
+#define	DLX_BR_NONZERO		2
+#define	DLX_BR_FPTRUE		3	// last FP compare was true
+#define	DLX_BR_FPFALSE		4
+
+#define	DLX_BR_OFFSET16		0	// PC + 16-bit immediate
+#define	DLX_BR_OFFSET26		1	// PC + J-format offset
+#define	DLX_BR_REGISTER		2	// first source register
+
+#define	DLX_BR_NO_LINK		0
+#define	DLX_BR_LINK		1
+
+//	handler		condition	target		link
+#define	DLX_BRANCH_INSTRS(X)						\
+  X (InstJmp,	DLX_BR_ALWAYS,	DLX_BR_OFFSET26, DLX_BR_NO_LINK)	\
+  X (InstJal,	DLX_BR_ALWAYS,	DLX_BR_OFFSET26, DLX_BR_LINK)		\
+  X (InstJr,	DLX_BR_ALWAYS,	DLX_BR_REGISTER, DLX_BR_NO_LINK)	\
+  X (InstJalr,	DLX_BR_ALWAYS,	DLX_BR_REGISTER, DLX_BR_LINK)		\
+  X (InstBeqz,	DLX_BR_ZERO,	DLX_BR_OFFSET16, DLX_BR_NO_LINK)	\
+  X (InstBnez,	DLX_BR_NONZERO,	DLX_BR_OFFSET16, DLX_BR_NO_LINK)	\
+  X (InstBfpt,	DLX_BR_FPTRUE,	DLX_BR_OFFSET16, DLX_BR_NO_LINK)	\
+  X (InstBfpf,	DLX_BR_FPFALSE,	DLX_BR_OFFSET16, DLX_BR_NO_LINK)
+
+template <int Cond, int Target, int Link>
 static
+inline
 int
-InstBeqz (uint32 inst, Cpu *cpu)
+BranchInst (const DecodedInst *d, Cpu *cpu)
 {
-  uint32	src, offset, dst;
+  uint32	target;
 
-  cpu->GetIFields (inst, src, offset, dst);
-  cpu->SignExtend16 (offset);
-  if (cpu->GetIreg (src) == 0) {
-    return (cpu->Jump (cpu->PC () + (int)offset));
-  } else {
+  if (((Cond == DLX_BR_ZERO) && (cpu->GetIreg (d->src1) != 0)) ||
+      ((Cond == DLX_BR_NONZERO) && (cpu->GetIreg (d->src1) == 0)) ||
+      ((Cond == DLX_BR_FPTRUE) && !cpu->StatusBit (DLX_STATUS_FPTRUE)) ||
+      ((Cond == DLX_BR_FPFALSE) && cpu->StatusBit (DLX_STATUS_FPTRUE))) {
     return (1);
   }
-}
-
-static
-int
-InstBnez (uint32 inst, Cpu *cpu)
-{
-  uint32	src, offset, dst;
-
-  cpu->GetIFields (inst, src, offset, dst);
-  cpu->SignExtend16 (offset);
-  if (cpu->GetIreg (src) != 0) {
-    return (cpu->Jump (cpu->PC () + (int)offset));
-  } else {
-    return (1);
+  if (Link == DLX_BR_LINK) {
+    cpu->PutIreg (31, cpu->PC ());
   }
-}
-
-static
-int
-InstBfpt (uint32 inst, Cpu *cpu)
-{
-  uint32	src, offset, dst;
-
-  cpu->GetIFields (inst, src, offset, dst);
-  cpu->SignExtend16 (offset);
-  if (cpu->StatusBit (DLX_STATUS_FPTRUE)) {
-    return (cpu->Jump (cpu->PC () + (int)offset));
+  if (Target == DLX_BR_REGISTER) {
+    target = cpu->GetIreg (d->src1);
   } else {
-    return (1);
+    target = cpu->PC () + ((Target == DLX_BR_OFFSET16) ? d->simm : d->jaddr);
+  }
+  if (Link == DLX_BR_LINK) {
+    DBPRINTF ('j', "Call from 0x%x to 0x%x.\n", cpu->PC (), target);
   }
+  return (cpu->Jump (target));
 }
 
-static
-int
-InstBfpf (uint32 inst, Cpu *cpu)
-{
-  uint32	src, offset, dst;
+#define	DLX_BRANCH_HANDLER(name, cond, target, link)			\
+  static int								\
+  name##Decoded (const DecodedInst *d, Cpu *cpu)			\
+  {									\
+    return (BranchInst<cond, target, link> (d, cpu));			\
+  }									\
+  DLX_RAW_HANDLER (name)
+
+DLX_BRANCH_INSTRS (DLX_BRANCH_HANDLER)
 
-  cpu->GetIFields (inst, src, offset, dst);
-  cpu->SignExtend16 (offset);
-  if (! cpu->StatusBit (DLX_STATUS_FPTRUE)) {
-    return (cpu->Jump (cpu->PC () + (int)offset));
-  } else {
-    return (1);
-  }
-}
-
 //----------------------------------------------------------------------
 //
 //	Integer multiply and divide (done by FP unit).  Note that
@@ -1215,6 +4069,9 @@ InstTrap (uint32 inst, Cpu *cpu)
   cpu->GetJFields (inst, trapVector);
   trapVector &= 0x0fffffff;
   DBPRINTF ('t',"Got a trap, inst=%08x, vector=%x\n", inst, trapVector);
+  if (statsFp != NULL) {
+    StatsTrap (trapVector);
+  }
   if ((trapVector == DLX_TRAP_EXIT) && ! cpu->IgnoreExit()) {
     cpu->Exit ();
   }
@@ -1226,7 +4083,11 @@ InstTrap (uint32 inst, Cpu *cpu)
   } else {
     cpu->OutputBasicBlock (cpu->PC()+4);
     if (cpu->Flags() & (DLX_TRACE_INSTRUCTIONS | DLX_TRACE_MEMORY)) {
-      fprintf (cpu->TraceFp(), "T %x %x\n", trapVector, cpu->PC());
+      if (traceBinary) {
+	TraceBinaryEvent (DLX_TRACE_REC_TRAP, trapVector, cpu->PC());
+      } else {
+	fprintf (cpu->TraceFp(), "T %x %x\n", trapVector, cpu->PC());
+      }
     }
     // Handle simulator services here.  This isn't so performance
     // critical, so we can use a switch statement.
@@ -1263,6 +4124,24 @@ InstTrap (uint32 inst, Cpu *cpu)
     case DLX_TRAP_TIMERGET:
       cpu->Timerget();
       break;
+    case DLX_TRAP_IDLE:
+      if (mpCur == mpCpus) {
+	EventsIdle ();
+      }
+      break;
+    case DLX_TRAP_CHECKPOINT:
+      CheckpointRequest (cpu);
+      break;
+    case DLX_TRAP_PERFCOUNTER:
+      cpu->PutIreg (1, PerfRead (cpu->GetIreg (1)));
+      break;
+    case DLX_TRAP_HEATMAP:
+      cpu->PutIreg (1, cpu->UserMode () ? 0 : HeatRead (cpu->GetIreg (1)));
+      break;
+    case DLX_TRAP_MEMMOVE:
+    case DLX_TRAP_MEMSET:
+      cpu->PutIreg (1, BulkMemory (cpu, trapVector));
+      break;
     }
   }
   return (1);
@@ -1293,9 +4172,14 @@ Cpu::DoRfe (uint32 inst)
     return (1);
   }
   iar = GetSreg (DLX_SREG_IAR) & ~0x3;
+  mpCur->llValid = 0;
   OutputBasicBlock (iar);
   if (flags & (DLX_TRACE_INSTRUCTIONS | DLX_TRACE_MEMORY)) {
-    fprintf (tracefp, "R %x %x\n", PC()-4, iar);
+    if (traceBinary) {
+      TraceBinaryEvent (DLX_TRACE_REC_RFE, PC()-4, iar);
+    } else {
+      fprintf (tracefp, "R %x %x\n", PC()-4, iar);
+    }
   }
   isr = GetSreg (DLX_SREG_ISR);
   PutSreg (DLX_SREG_STATUS, isr);
@@ -1321,6 +4205,24 @@ InstMovi2s (uint32 inst, Cpu *cpu)
   cpu->GetRFields (inst, src1, src2, dst);
   DBPRINTF ('S',"Moving integer reg %d (0x%x) to special reg %d.\n",
 	    src1, cpu->GetIreg(src1), dst);
+  if (dst == DLX_SREG_CPUID) {
+    return (1);		// read only
+  }
+  if (PerfIsCounter (dst)) {
+    if (dst == DLX_SREG_PERF_EXCSEL) {
+      perfExcSel = cpu->GetIreg (src1);
+      if (perfExcSel > DLX_PERF_EXC_TRAPS) {
+	perfExcSel = DLX_PERF_EXC_TRAPS;
+      }
+    }
+    return (1);
+  }
+  // The OS reloads the page table registers on every return from an
+  // exception, so only flush if the geometry really changed.
+  if (((dst == DLX_SREG_PGTBL_BITS) || (dst == DLX_SREG_PGTBL_SIZE)) &&
+      (cpu->GetSreg (dst) != cpu->GetIreg (src1))) {
+    XlateFlush ();
+  }
   cpu->PutSreg (dst, cpu->GetIreg (src1));
   return (1);
 }
@@ -1338,7 +4240,8 @@ InstMovs2i (uint32 inst, Cpu *cpu)
   cpu->GetRFields (inst, src1, src2, dst);
   DBPRINTF ('S',"Moving special reg %d (0x%x) to integer reg %d.\n",
 	    src1, cpu->GetSreg(src1), dst);
-  cpu->PutIreg (dst, cpu->GetSreg (src1));
+  cpu->PutIreg (dst, PerfIsCounter (src1) ? PerfRead (src1) :
+		cpu->GetSreg (src1));
   return (1);
 }
 
@@ -1411,229 +4314,126 @@ InstDivf (uint32 inst, Cpu *cpu)
 
 //----------------------------------------------------------------------
 //
-//	Single precision FP comparison instructions
+//	FP comparison instructions
+//
+//	Generated like the ALU handlers, from DLX_FPCMP_INSTRS.  Each line
+//	gives the handler, the comparison (one of DLX_FPCMP_OPS) and the
+//	precision.  The result is left in the FPTRUE status bit.
 //
 //----------------------------------------------------------------------
+#define	DLX_FP_SINGLE		0
+#define	DLX_FP_DOUBLE		1
+
+#define	DLX_FPCMP_OPS(X)						\
+  X (Eq,	v1 == v2)						\
+  X (Ne,	v1 != v2)						\
+  X (Lt,	v1 < v2)						\
+  X (Gt,	v1 > v2)						\
+  X (Le,	v1 <= v2)						\
+  X (Ge,	v1 >= v2)
+
+//	handler		op	precision
+#define	DLX_FPCMP_INSTRS(X)						\
+  X (InstEqf,	Eq,	DLX_FP_SINGLE)					\
+  X (InstNef,	Ne,	DLX_FP_SINGLE)					\
+  X (InstLtf,	Lt,	DLX_FP_SINGLE)					\
+  X (InstGtf,	Gt,	DLX_FP_SINGLE)					\
+  X (InstLef,	Le,	DLX_FP_SINGLE)					\
+  X (InstGef,	Ge,	DLX_FP_SINGLE)					\
+  X (InstEqd,	Eq,	DLX_FP_DOUBLE)					\
+  X (InstNed,	Ne,	DLX_FP_DOUBLE)					\
+  X (InstLtd,	Lt,	DLX_FP_DOUBLE)					\
+  X (InstGtd,	Gt,	DLX_FP_DOUBLE)					\
+  X (InstLed,	Le,	DLX_FP_DOUBLE)					\
+  X (InstGed,	Ge,	DLX_FP_DOUBLE)
+
+#define	DLX_FPCMP_OP_STRUCT(name, expr)					\
+  struct FpCmp##name {							\
+    template <class T>							\
+    static inline int Do (T v1, T v2) { return (expr); }		\
+  };
+
+DLX_FPCMP_OPS (DLX_FPCMP_OP_STRUCT)
+
+template <class Op, int Precision>
 static
+inline
 int
-InstEqf (uint32 inst, Cpu *cpu)
+FpCmpInst (const DecodedInst *d, Cpu *cpu)
 {
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregF (src1) == cpu->GetFregF (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
-  return (1);
-}
+  int		result;
 
-static
-int
-InstNef (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregF (src1) != cpu->GetFregF (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
+  if (Precision == DLX_FP_DOUBLE) {
+    result = Op::Do (cpu->GetFregD (d->src1), cpu->GetFregD (d->src2));
   } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
-  return (1);
-}
-static
-int
-InstLtf (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregF (src1) < cpu->GetFregF (src2)) {
+    result = Op::Do (cpu->GetFregF (d->src1), cpu->GetFregF (d->src2));
+  }
+  if (result) {
     cpu->SetStatusBit (DLX_STATUS_FPTRUE);
   } else {
     cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
+  }
   return (1);
 }
 
-static
-int
-InstGtf (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregF (src1) > cpu->GetFregF (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
-  return (1);
-}
+#define	DLX_FPCMP_HANDLER(name, op, precision)				\
+  static int								\
+  name##Decoded (const DecodedInst *d, Cpu *cpu)			\
+  {									\
+    return (FpCmpInst<FpCmp##op, precision> (d, cpu));			\
+  }									\
+  DLX_RAW_HANDLER (name)
 
-static
-int
-InstLef (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregF (src1) <= cpu->GetFregF (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
-  return (1);
-}
+DLX_FPCMP_INSTRS (DLX_FPCMP_HANDLER)
 
-static
-int
-InstGef (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregF (src1) >= cpu->GetFregF (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
-  return (1);
-}
-
 //----------------------------------------------------------------------
 //
 //	Double precision FP math instructions.
-//
-//----------------------------------------------------------------------
-static
-int
-InstAddd (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutFregD (dst, cpu->GetFregD (src1) + cpu->GetFregD (src2));
-  return (1);
-}
-
-static
-int
-InstSubd (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutFregD (dst, cpu->GetFregD (src1) - cpu->GetFregD (src2));
-  return (1);
-}
-
-static
-int
-InstMultd (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  cpu->PutFregD (dst, cpu->GetFregD (src1) * cpu->GetFregD (src2));
-  return (1);
-}
-
-static
-int
-InstDivd (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  double	denom;
-  cpu->GetRFields (inst, src1, src2, dst);
-  denom = cpu->GetFregD (src2);
-  if (denom == (double)0.0) {
-    cpu->CauseException (DLX_EXC_DIV0);
-  } else {
-    cpu->PutFregD (dst, cpu->GetFregD(src1) / denom);
-  }
-  return (1);
-}
-
-//----------------------------------------------------------------------
-//
-//	Double precision FP comparison instructions
-//
-//----------------------------------------------------------------------
-static
-int
-InstEqd (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregD (src1) == cpu->GetFregD (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
-  return (1);
-}
-
-static
-int
-InstNed (uint32 inst, Cpu *cpu)
-{
-  uint32	src1, src2, dst;
-  cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregD (src1) != cpu->GetFregD (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
-  return (1);
-}
-
+//
+//----------------------------------------------------------------------
 static
 int
-InstLtd (uint32 inst, Cpu *cpu)
+InstAddd (uint32 inst, Cpu *cpu)
 {
   uint32	src1, src2, dst;
   cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregD (src1) < cpu->GetFregD (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
+  cpu->PutFregD (dst, cpu->GetFregD (src1) + cpu->GetFregD (src2));
   return (1);
 }
 
 static
 int
-InstGtd (uint32 inst, Cpu *cpu)
+InstSubd (uint32 inst, Cpu *cpu)
 {
   uint32	src1, src2, dst;
   cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregD (src1) > cpu->GetFregD (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
+  cpu->PutFregD (dst, cpu->GetFregD (src1) - cpu->GetFregD (src2));
   return (1);
 }
 
 static
 int
-InstLed (uint32 inst, Cpu *cpu)
+InstMultd (uint32 inst, Cpu *cpu)
 {
   uint32	src1, src2, dst;
   cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregD (src1) <= cpu->GetFregD (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
-  } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
+  cpu->PutFregD (dst, cpu->GetFregD (src1) * cpu->GetFregD (src2));
   return (1);
 }
 
 static
 int
-InstGed (uint32 inst, Cpu *cpu)
+InstDivd (uint32 inst, Cpu *cpu)
 {
   uint32	src1, src2, dst;
+  double	denom;
   cpu->GetRFields (inst, src1, src2, dst);
-  if (cpu->GetFregD (src1) >= cpu->GetFregD (src2)) {
-    cpu->SetStatusBit (DLX_STATUS_FPTRUE);
+  denom = cpu->GetFregD (src2);
+  if (denom == (double)0.0) {
+    cpu->CauseException (DLX_EXC_DIV0);
   } else {
-    cpu->ClrStatusBit (DLX_STATUS_FPTRUE);
-  }	
+    cpu->PutFregD (dst, cpu->GetFregD(src1) / denom);
+  }
   return (1);
 }
 
@@ -1830,7 +4630,7 @@ Instruction Cpu::regInstrs[64] = {
   {0x2d, DLX_FMT_IFMT, InstIllegal},
   {0x2e, DLX_FMT_IFMT, InstSf},
   {0x2f, DLX_FMT_IFMT, InstSd},
-  {0x30, DLX_FMT_IFMT, InstIllegal},
+  {0x30, DLX_FMT_IFMT, InstLl},
   {0x31, DLX_FMT_IFMT, InstIllegal},
   {0x32, DLX_FMT_IFMT, InstIllegal},
   {0x33, DLX_FMT_IFMT, InstIllegal},
@@ -1838,7 +4638,7 @@ Instruction Cpu::regInstrs[64] = {
   {0x35, DLX_FMT_IFMT, InstIllegal},
   {0x36, DLX_FMT_IFMT, InstIllegal},
   {0x37, DLX_FMT_IFMT, InstIllegal},
-  {0x38, DLX_FMT_IFMT, InstIllegal},
+  {0x38, DLX_FMT_IFMT, InstSc},
   {0x39, DLX_FMT_IFMT, InstIllegal},
   {0x3a, DLX_FMT_IFMT, InstIllegal},
   {0x3b, DLX_FMT_IFMT, InstIllegal},
@@ -1905,10 +4705,20 @@ Cpu::CauseException (int excType)
 
   DBPRINTF ('t',"Exception being done (cause=0x%x @ pc=0x%x).\n",excType,
 	    PC()-4);
+  mpCur->llValid = 0;
+  PerfException (excType);
+  if (excType < DLX_EXC_PAGEFAULT) {
+    // A fault: the guest may be about to die, so get its output out.
+    ConsoleFlush ();
+  }
   ivec = GetSreg (DLX_SREG_INTRVEC);
   OutputBasicBlock (ivec);
   if (flags & (DLX_TRACE_INSTRUCTIONS | DLX_TRACE_MEMORY)) {
-    fprintf (tracefp, "X %x %x\n",excType, PC()-4);
+    if (traceBinary) {
+      TraceBinaryEvent (DLX_TRACE_REC_EXC, excType, PC()-4);
+    } else {
+      fprintf (tracefp, "X %x %x\n",excType, PC()-4);
+    }
   }
   PutSreg(DLX_SREG_CAUSE, excType);
   // PC has already been incremented, so decrement it first.  If this
@@ -1949,9 +4759,10 @@ int
 Cpu::VaddrToPaddr (uint32 vaddr, uint32& paddr, uint32 op, uint32 pteflags)
 {
   uint32	pt1base, pt2base, pt1pagebits, pt2pagebits;
-  uint32	pteaddr;
+  uint32	pteaddr, l1addr;
   uint32	offsetinpage, entrynum;
   uint32	pagemask;
+  XlateEntry	*e;
 
   if ((vaddr & 0x3) != 0) {
     CauseException (DLX_EXC_ADDRESS);
@@ -1974,37 +4785,46 @@ Cpu::VaddrToPaddr (uint32 vaddr, uint32& paddr, uint32 op, uint32 pteflags)
       offsetinpage = vaddr & pagemask;
       // Mask off the low bits
       vaddr &= ~pagemask;
-      if ((entrynum = (vaddr >> pt1pagebits)) >=
-	  GetSreg (DLX_SREG_PGTBL_SIZE)) {
-	DBPRINTF ('m', "Out of range (L1 = %db, L2 = %db size=%d entry=%d)\n",
-		  pt1pagebits, pt2pagebits, GetSreg(DLX_SREG_PGTBL_SIZE),
-		  entrynum);
-	CauseException (DLX_EXC_ACCESS);
-	return (0);
-      }
-      pteaddr = pt1base + 4 * entrynum;
-      paddr = Memory (pteaddr);
-      // If the L2 page size is the same as the L1 page size, there's
-      // no L2 page table!
-      if (pt1pagebits != pt2pagebits) {
-	pt2base = paddr;
-	if (pt2base == 0) {
-	  DBPRINTF ('m', "No L2 table at entry %d! (base = 0x%x)\n",
-		    entrynum, pt1base);
-          PutSreg (DLX_SREG_FAULT_ADDR, vaddr);
-	  CauseException (DLX_EXC_PAGEFAULT);
+      entrynum = vaddr >> pt1pagebits;
+      e = XlateLookup (pt1base, vaddr, pt2pagebits);
+      if (e->valid && (e->vpage == vaddr) && (e->base == pt1base)) {
+	pteaddr = e->pteaddr;
+	paddr = e->pte;
+	DBPRINTF ('M', "Using cached PTE 0x%08x\n", paddr);
+      } else {
+	if (entrynum >= GetSreg (DLX_SREG_PGTBL_SIZE)) {
+	  DBPRINTF ('m', "Out of range (L1 = %db, L2 = %db size=%d entry=%d)\n",
+		    pt1pagebits, pt2pagebits, GetSreg(DLX_SREG_PGTBL_SIZE),
+		    entrynum);
+	  CauseException (DLX_EXC_ACCESS);
 	  return (0);
 	}
-	pteaddr = pt2base + 4 * ((vaddr >> pt2pagebits) &
-				 ((1 << (pt1pagebits-pt2pagebits))-1));
+	l1addr = pteaddr = pt1base + 4 * entrynum;
 	paddr = Memory (pteaddr);
-      }
-      DBPRINTF ('M', "Using PTE 0x%08x\n", paddr);
-      if (!(paddr & DLX_PTE_VALID)) {
-	DBPRINTF ('m', "PTE invalid (0x%08x)\n", paddr);
-	PutSreg (DLX_SREG_FAULT_ADDR, vaddr);
-	CauseException (DLX_EXC_PAGEFAULT);
-	return (0);
+	// If the L2 page size is the same as the L1 page size, there's
+	// no L2 page table!
+	if ((pt1pagebits != pt2pagebits) && !(paddr & DLX_PTE_SUPERPAGE)) {
+	  pt2base = paddr;
+	  if (pt2base == 0) {
+	    DBPRINTF ('m', "No L2 table at entry %d! (base = 0x%x)\n",
+		      entrynum, pt1base);
+	    PutSreg (DLX_SREG_FAULT_ADDR, vaddr);
+	    CauseException (DLX_EXC_PAGEFAULT);
+	    return (0);
+	  }
+	  pteaddr = pt2base + 4 * ((vaddr >> pt2pagebits) &
+				   ((1 << (pt1pagebits-pt2pagebits))-1));
+	  paddr = Memory (pteaddr);
+	}
+	DBPRINTF ('M', "Using PTE 0x%08x\n", paddr);
+	if (!(paddr & DLX_PTE_VALID)) {
+	  DBPRINTF ('m', "PTE invalid (0x%08x)\n", paddr);
+	  PutSreg (DLX_SREG_FAULT_ADDR, vaddr);
+	  CauseException (DLX_EXC_PAGEFAULT);
+	  return (0);
+	}
+	XlateFill (e, pt1base, vaddr, l1addr, pteaddr, paddr);
+	perfWalks++;
       }
 
       //Zheng{
@@ -2022,19 +4842,37 @@ Cpu::VaddrToPaddr (uint32 vaddr, uint32& paddr, uint32 op, uint32 pteflags)
 
       //Zheng{
 #if USE_ROP
-      if (pteflags & DLX_PTE_DIRTY) {
+      if (pteflags & xlateAdMask & DLX_PTE_DIRTY & ~paddr) {
 	SetMemory (pteaddr,
 		   paddr | (pteflags & DLX_PTE_DIRTY));
+	PredecodeInvalidate (pteaddr);
+	BlockInvalidate (pteaddr);
+	if (e->valid && (e->pteaddr == pteaddr)) {
+	  e->pte = paddr | (pteflags & DLX_PTE_DIRTY);
+	}
       }
 #else
       //}Zheng
-      if (pteflags & (DLX_PTE_DIRTY | DLX_PTE_REFERENCED)) {
+      if (pteflags & xlateAdMask & ~paddr) {
 	SetMemory (pteaddr,
 		   paddr | (pteflags & (DLX_PTE_DIRTY | DLX_PTE_REFERENCED)));
+	PredecodeInvalidate (pteaddr);
+	BlockInvalidate (pteaddr);
+	// Keep the cached copy identical to the PTE in memory.
+	if (e->valid && (e->pteaddr == pteaddr)) {
+	  e->pte = paddr | (pteflags & (DLX_PTE_DIRTY | DLX_PTE_REFERENCED));
+	}
       }
       //Zheng
 #endif
 
+      if ((pt1pagebits != pt2pagebits) && (paddr & DLX_PTE_SUPERPAGE)) {
+	// The page number bits below the L1 field come straight from
+	// the virtual address.
+	pagemask = (1 << pt1pagebits) - 1;
+	offsetinpage |= vaddr & pagemask;
+	paddr &= ~DLX_PTE_SUPERPAGE;
+      }
       paddr &= ~(pagemask | DLX_PTE_MASK);
       paddr |= offsetinpage;
       DBPRINTF ('m',
@@ -2057,8 +4895,24 @@ Cpu::VaddrToPaddr (uint32 vaddr, uint32& paddr, uint32 op, uint32 pteflags)
       }
     }
   } else if (StatusBit (DLX_STATUS_TLB)) {
-    // DLX_STATUS_TLB
-    return (1);
+    // Same rules as for page tables about which references are
+    // translated.
+    if (UserMode () ||
+	((op == DLX_MEM_READ) &&
+	 (GetSreg (DLX_SREG_STATUS) & DLX_STATUS_XLATE_RD)) ||
+	((op == DLX_MEM_WRITE) &&
+	 (GetSreg (DLX_SREG_STATUS) & DLX_STATUS_XLATE_WR))) {
+      return (SwTlbTranslate (this, vaddr, paddr, op, pteflags));
+    }
+    paddr = vaddr;
+    if ((vaddr <= memSize) || ((vaddr >= DLX_IO_BASE) &&
+			       (vaddr <= (DLX_IO_BASE+DLX_IO_SIZE)))) {
+      return (1);
+    } else {
+      DBPRINTF ('t',"Illegal system address: 0x%x.\n", vaddr);
+      CauseException (DLX_EXC_ACCESS);
+      return (0);
+    }
   } else {
     paddr = vaddr;
     return (1);
@@ -2070,7 +4924,9 @@ Cpu::VaddrToPaddr (uint32 vaddr, uint32& paddr, uint32 op, uint32 pteflags)
 //	Cpu::ReadWord
 //
 //	Read a word from memory.  This can either be a regular memory
-//	address or an I/O address.
+//	address or an I/O address.  With DLX_MEM_PADDR_STORE or
+//	DLX_MEM_PADDR_LOAD, only translate the address for a store or load
+//	and return the physical address in val (see "Sub-word accesses").
 //
 //----------------------------------------------------------------------
 int
@@ -2079,6 +4935,17 @@ Cpu::ReadWord (uint32 vaddr, uint32 &val, uint32 op)
   uint32	paddr;
 
   DBPRINTF ('l',"Trying to read virtual address: 0x%x.\n", vaddr);
+  if (op & DLX_MEM_PADDR) {
+#if USE_ROP
+    return (VaddrToPaddr (vaddr, val, op & ~DLX_MEM_PADDR,
+			  (op == DLX_MEM_PADDR_STORE) ? DLX_PTE_DIRTY : 0));
+#else
+    return (VaddrToPaddr (vaddr, val, op & ~DLX_MEM_PADDR,
+			  (op == DLX_MEM_PADDR_STORE) ?
+			  (DLX_PTE_DIRTY | DLX_PTE_REFERENCED) :
+			  DLX_PTE_REFERENCED));
+#endif
+  }
 //Zheng{
 #if USE_ROP
   if (!VaddrToPaddr (vaddr, paddr, op, 0)) {
@@ -2088,8 +4955,19 @@ Cpu::ReadWord (uint32 vaddr, uint32 &val, uint32 op)
 #endif
     return (0);
   }
+  if (op != DLX_MEM_INSTR) {
+    perfLoads++;
+  }
   if (paddr <= memSize) {
     val = Memory(paddr);
+    if (cacheModel) {
+      CacheAccess ((op == DLX_MEM_INSTR) ? &cacheL1I : &cacheL1D, paddr,
+		   UserMode ());
+    }
+    if (heatPages != NULL) {
+      HeatCount (paddr, (op == DLX_MEM_INSTR) ? DLX_HEAT_FETCHES :
+		 DLX_HEAT_READS, UserMode (), GetSreg (DLX_SREG_PGTBL_BASE));
+    }
   } else {
     DBPRINTF ('l',"Trying to load special address: 0x%x.\n", paddr);
     switch (paddr) {
@@ -2104,9 +4982,39 @@ Cpu::ReadWord (uint32 vaddr, uint32 &val, uint32 op)
       break;
     case DLX_DISK_STATUS:
       break;
+    case DLX_DMA_DONE:
+      val = DmaPopDone ();
+      break;
+    case DLX_DMA_PENDING:
+      val = dmaCount;
+      break;
+    case DLX_DMA_NBLOCKS:
+      val = dmaNblocks;
+      break;
+    case DLX_DMA_BLOCKSIZE:
+      val = DLX_DMA_BLOCK_SIZE;
+      break;
     case DLX_GETMEMSIZE:
       val = memSize;
       break;
+    case DLX_TLB_INDEX:
+      val = swtlbIndex;
+      break;
+    case DLX_TLB_ENTRYHI:
+      val = swtlbHi;
+      break;
+    case DLX_TLB_ENTRYLO:
+      val = swtlbLo;
+      break;
+    case DLX_TLB_NENTRIES:
+      val = swtlbEntries;
+      break;
+    case DLX_MP_NCPUS:
+      val = mpCount;
+      break;
+    case DLX_MP_START_PC:
+      val = mpStartPc;
+      break;
     default:
       CauseException (DLX_EXC_ACCESS);
       break;
@@ -2119,6 +5027,8 @@ int
 Cpu::WriteWord (uint32 vaddr, uint32 val)
 {
   uint32	paddr;
+  int		i;
+  Cpu		*c;
   //Zheng{
 #if USE_ROP
   if (!VaddrToPaddr (vaddr, paddr, DLX_MEM_WRITE,
@@ -2131,8 +5041,17 @@ Cpu::WriteWord (uint32 vaddr, uint32 val)
     return (0);
   }
 
+  perfStores++;
   if (paddr <= memSize) {
     SetMemory(paddr, val);
+    MemoryWritten (paddr);
+    if (cacheModel) {
+      CacheAccess (&cacheL1D, paddr, UserMode ());
+    }
+    if (heatPages != NULL) {
+      HeatCount (paddr, DLX_HEAT_WRITES, UserMode (),
+		 GetSreg (DLX_SREG_PGTBL_BASE));
+    }
   } else {
     switch (paddr) {
     case DLX_KBD_PUTCHAR:
@@ -2149,18 +5068,99 @@ Cpu::WriteWord (uint32 vaddr, uint32 val)
       DBPRINTF ('o',"Setting timer to %d us.\n", val);
       SetTimer (val);
       break;
-#if 0
-    case DLX_DISK_REQUEST:
-      diskReq = val;
-      StartDiskIo ();
+    case DLX_TLB_INDEX:
+      swtlbIndex = val;
       break;
-    case DLX_DISK_BLOCK:
-      diskBlock = val;
+    case DLX_TLB_ENTRYHI:
+      swtlbHi = val;
       break;
-    case DLX_DISK_ADDR:
-      diskAddr = val;
+    case DLX_TLB_ENTRYLO:
+      swtlbLo = val;
+      break;
+    case DLX_TLB_WRITE:
+      SwTlbLoad (this, swtlbIndex);
+      break;
+    case DLX_TLB_REPLACE:
+      SwTlbLoad (this, swtlbNext);
+      swtlbNext = (swtlbNext + 1) % swtlbEntries;
+      break;
+    case DLX_TLB_READ:
+      if (swtlbIndex >= swtlbEntries) {
+	CauseException (DLX_EXC_ACCESS);
+      } else {
+	swtlbHi = swtlb[swtlbIndex].vpage;
+	swtlbLo = swtlb[swtlbIndex].valid ? swtlb[swtlbIndex].pte : 0;
+      }
+      break;
+    case DLX_TLB_PROBE:
+      i = SwTlbFind (this, val);
+      swtlbIndex = (i < 0) ? DLX_TLB_NO_ENTRY : i;
+      break;
+    case DLX_TLB_FLUSH:
+      SwTlbFlush ();
+      break;
+    case DLX_DMA_QUEUE:
+      if ((dmaImage == NULL) || (dmaCount == DLX_DMA_MAX_QUEUE) ||
+	  (val + 16 >= memSize)) {
+	CauseException (DLX_EXC_ACCESS);
+	break;
+      }
+      i = (dmaHead + dmaCount) % DLX_DMA_MAX_QUEUE;
+      dmaQueue[i].desc = val;
+      dmaQueue[i].op = Memory (val);
+      dmaQueue[i].block = Memory (val + 4);
+      dmaQueue[i].paddr = Memory (val + 8);
+      dmaQueue[i].count = Memory (val + 12);
+      SetMemory (val + 16, DLX_DMA_STATUS_PENDING);
+      MemoryWritten (val + 16);
+      if (dmaCount++ == 0) {
+	SYNC_SIM_TIME ();
+	DmaStart (usElapsed, usPerInst);
+      }
+      break;
+    case DLX_MP_START_PC:
+      mpStartPc = val;
+      break;
+    case DLX_MP_START:
+      if ((val >= (uint32)mpCount) || mpCpus[val].running) {
+	CauseException (DLX_EXC_ACCESS);
+	break;
+      }
+      DBPRINTF ('t', "CPU %d started at 0x%x\n", val, mpStartPc);
+      c = new Cpu (*this);
+      for (i = 0; i < 32; i++) {
+	c->ireg[i] = 0;
+      }
+      c->sreg[DLX_SREG_STATUS] = (GetSreg (DLX_SREG_STATUS) &
+				  (DLX_STATUS_PAGE_TABLE | DLX_STATUS_TLB)) |
+	DLX_STATUS_SYSMODE;
+      c->DisableInterrupts ();
+      c->sreg[DLX_SREG_CAUSE] = c->sreg[DLX_SREG_IAR] = 0;
+      c->sreg[DLX_SREG_ISR] = c->sreg[DLX_SREG_IR31] = 0;
+      c->sreg[DLX_SREG_CPUID] = val;
+      c->timerInterrupt = DLX_TIMER_NOT_ACTIVE;
+      c->instrsExecuted = 0.0;
+      c->SetPC (mpStartPc);
+      mpCpus[val].cpu = c;
+      mpCpus[val].swtlb = new SwTlbEntry[swtlbEntries];
+      for (i = 0; i < (int)swtlbEntries; i++) {
+	mpCpus[val].swtlb[i].valid = 0;
+      }
+      mpCpus[val].running = 1;
+      mpRunning++;
+      break;
+    case DLX_MP_IPI:
+      if (val >= (uint32)mpCount) {
+	CauseException (DLX_EXC_ACCESS);
+	break;
+      }
+      mpCpus[val].ipiPending = 1;
+      if (val == 0) {
+	// CPU 0 takes it at its next event check.
+	eventAt[DLX_EVENT_IPI] = simInstrs + 1;
+	EventsSchedule ();
+      }
       break;
-#endif
     default:
       CauseException (DLX_EXC_ACCESS);
       break;
@@ -2231,6 +5231,9 @@ Cpu::Open ()
       // If fopen fails, it returns NULL, so it looks like no open
       // was done.
       fp[i] = fopen (nameBuf, tp);
+      strncpy (ckptFileNames[i], nameBuf, DLX_CKPT_NAMELEN - 1);
+      ckptFileModes[i] = accessType;
+      DiskModelOpened (i, nameBuf);
       break;
     }
   }
@@ -2275,6 +5278,8 @@ Cpu::FileIo (int kind)
   uint32	buf;
   int		size;
   int		n;
+  long		pos;
+  long long	stall;
 
   fd = GetParam (0);
   buf = GetParam (1);
@@ -2286,10 +5291,24 @@ Cpu::FileIo (int kind)
     SetResult (0xffffffff);
     return;
   }
+  pos = ftell (fp[fd]);
   if (kind == DLX_FILE_WRITE) {
     n = fwrite ((unsigned char *)memory + buf, 1, size, fp[fd]);
   } else {
     n = fread ((unsigned char *)memory + buf, 1, size, fp[fd]);
+    if (n > 0) {
+      MemoryRangeWritten (buf, n);
+    }
+  }
+  if (diskModelFds[fd] && (n > 0) && (pos >= 0)) {
+    // Stall for the access, like a cache miss: the time passes but no
+    // instructions are executed.
+    SYNC_SIM_TIME ();
+    stall = (long long)(DiskModelTime (usElapsed, pos / DLX_DISKMODEL_BLOCK,
+				       n) / usPerInst);
+    simInstrs += stall;
+    stallCycles += stall;
+    diskStallCycles += stall;
   }
   if (n > 0) {
     SetResult (n);
@@ -2483,10 +5502,10 @@ Cpu::Printf ()
       nargs += 1;
     }
   }
-  printf (fmtaddr + (char *)memory,
-	  args[0], args[1], args[2], args[3],
-	  args[4], args[5], args[6], args[7]);
-  fflush (stdout);
+  fprintf (consoleFp, fmtaddr + (char *)memory,
+	   args[0], args[1], args[2], args[3],
+	   args[4], args[5], args[6], args[7]);
+  ConsoleWritten ();
 }
 
 //----------------------------------------------------------------------
@@ -2501,10 +5520,34 @@ void
 Cpu::Exit ()
 {
   struct timeval	t;
+  int			i;
 
+  if (mpCur != mpCpus) {
+    // The statistics are kept by CPU 0.
+    MpSwitch (&mpCpus[0]);
+    mpCpus[0].cpu->Exit ();
+  }
+  SYNC_SIM_TIME ();
+  ConsoleFlush ();
   printf ("Exiting at program request.\n");
   printf ("Instructions executed: %.0lf\n", instrsExecuted);
+  for (i = 1; i < mpCount; i++) {
+    if (mpCpus[i].running) {
+      printf ("CPU %d instructions executed: %.0lf\n", i, mpCpus[i].instrs);
+    }
+  }
   printf ("Time simulated: %.03lf secs\n", usElapsed / 1e6);
+  if (idleUsSkipped > 0.0) {
+    printf ("Idle time skipped: %.03lf secs\n", idleUsSkipped / 1e6);
+  }
+  if (swtlbMisses > 0.0) {
+    printf ("Software TLB misses: %.0lf\n", swtlbMisses);
+  }
+  CacheReport ();
+  DiskModelReport ();
+  if (dmaBlocks > 0.0) {
+    printf ("Disk blocks transferred by DMA: %.0lf\n", dmaBlocks);
+  }
   //Zheng add timezone*
   //gettimeofday (&t, (timezone*)(void *)0);
   gettimeofday (&t, (void *)0);
@@ -2512,79 +5555,415 @@ Cpu::Exit ()
   printf ("Real time elapsed: %.03lf secs\n", realElapsed);
   printf ("Execution rate: %.2lfM simulated instructions per real second.\n",
 	  instrsExecuted * 1e-6 / realElapsed);
+  ProfileReport ();
+  StatsReport (instrsExecuted);
+  HeatDump (instrsExecuted);
+  TraceBinaryClose ();
   exit (0);
 }
 
+//----------------------------------------------------------------------
+//
+//	DecodeInst
+//
+//	Decode an instruction into *d: its handler from the instruction
+//	tables (which are passed in, since they're private to the Cpu), its
+//	operand fields, and the handler ExecOne runs it with.  The latter
+//	is found the first time through by looking each table handler up
+//	in decodedForms, and kept in arrays that parallel the tables.
+//
+//----------------------------------------------------------------------
+#define	DLX_DECODED_FORM(name, ...)					\
+  {name, name##Decoded},
+
+static const struct {
+  InstHandler	handler;
+  DecodedHandler exec;
+} decodedForms[] = {
+  DLX_ALU_INSTRS (DLX_DECODED_FORM)
+  DLX_LOAD_INSTRS (DLX_DECODED_FORM)
+  DLX_STORE_INSTRS (DLX_DECODED_FORM)
+  DLX_BRANCH_INSTRS (DLX_DECODED_FORM)
+  DLX_FPCMP_INSTRS (DLX_DECODED_FORM)
+};
+
+static DecodedHandler	rrrExec[64];
+static DecodedHandler	regExec[64];
+static DecodedHandler	fpExec[32];
+static int		decodedReady;
+
+static
+DecodedHandler
+DecodedForm (InstHandler handler)
+{
+  unsigned	i;
+
+  for (i = 0; i < sizeof (decodedForms) / sizeof (decodedForms[0]); i++) {
+    if (decodedForms[i].handler == handler) {
+      return (decodedForms[i].exec);
+    }
+  }
+  return (DecodedLegacy);
+}
+
+static
+void
+DecodedInit (Instruction *rrr, Instruction *reg, Instruction *fp)
+{
+  int		i;
+
+  for (i = 0; i < 64; i++) {
+    rrrExec[i] = DecodedForm (rrr[i].handler);
+    regExec[i] = DecodedForm (reg[i].handler);
+  }
+  for (i = 0; i < 32; i++) {
+    fpExec[i] = DecodedForm (fp[i].handler);
+  }
+  decodedReady = 1;
+}
+
+static
+inline
+void
+DecodeInst (DecodedInst *d, uint32 inst, Instruction *rrr, Instruction *reg,
+	    Instruction *fp)
+{
+  uint32	op = (inst >> DLX_OPCODE_SHIFT) & DLX_OPCODE_MASK;
+  uint32	func;
+
+  if (! decodedReady) {
+    DecodedInit (rrr, reg, fp);
+  }
+  DecodeFields (d, inst);
+  switch (op) {
+  case 0x00:		// ALU and other R-R operations
+    func = (inst >> DLX_ALU_FUNC_CODE_SHIFT) & DLX_ALU_FUNC_CODE_MASK;
+    d->handler = rrr[func].handler;
+    d->exec = rrrExec[func];
+    break;
+  case 0x01:		// FP operations
+    func = (inst >> DLX_FPU_FUNC_CODE_SHIFT) & DLX_FPU_FUNC_CODE_MASK;
+    d->handler = fp[func].handler;
+    d->exec = fpExec[func];
+    break;
+  default:
+    d->handler = reg[op].handler;
+    d->exec = regExec[op];
+    break;
+  }
+}
+
 //----------------------------------------------------------------------
 //
 //	Cpu::ExecOne
 //
-//	Execute a single CPU instruction in the simulator.
+//	Execute a single CPU instruction in the simulator.  If basic block
+//	translation is turned on, execute the rest of the basic block
+//	starting at the PC instead.
 //
 //----------------------------------------------------------------------
 int
 Cpu::ExecOne ()
 {
   uint32	curInst;
-  uint32	tmpPc;
   uint32	curOp;
   uint32	retval;
-  uint32	funcCode;		// subcode for RRR & FP ops
-
-  usElapsed += usPerInst;
-  instrsExecuted += 1.0;
-  // Increment PC before checking for interrupts because CauseException
-  // will subtract 4 off the PC before placing the value into the IAR.
-  // By incrementing here, we ensure that the current instruction is
-  // the one whose address goes into the IAR.
-  SetPC (PC() + 4);
-  // Check for an input character.  If we got one and interrupts are
-  // enabled, do an interrupt.
-  if (kbdcounter++ > DLX_KBD_FREQUENCY) {
-    kbdcounter = 0;
-    if (GetCharIfAvail () && (IntrLevel () < 8)) {
-      DBPRINTF ('t',"Keyboard interrupt at PC=0x%x, t=%.0fus\n",
-		PC()-4, usElapsed);
-      CauseException (DLX_EXC_KBD);
+  uint32	paddr, nextPc;
+  DecodedInst	*d;
+  DecodedInst	decoded;
+  TranslatedBlock *b;
+  uint32	*m;
+  uint32	desc, status;
+  int		i;
+  int		kbdLeft;
+
+  if (mpCur != mpCpus) {
+    // Another CPU, run from CPU 0's ExecOne below: keep its clock at
+    // CPU 0's and check for its own interrupts.  The events are all
+    // CPU 0's.
+    SetPC (PC() + 4);
+    mpCur->instrs += 1.0;
+    usElapsed = mpCpus[0].cpu->usElapsed +
+      (double)(simInstrs - syncedInstrs) * usPerInst;
+    if (mpCur->ipiPending && (IntrLevel () < 8)) {
+      mpCur->ipiPending = 0;
+      CauseException (DLX_EXC_IPI);
       return (0);
     }
-  }
-  if (IntrLevel() < 8) {
-    if (timerInterrupt < usElapsed) {
-      DBPRINTF ('t', "Timer interrupt at PC=0x%x, t=%.0fus, intr@%.0fus\n",
-		PC()-4, usElapsed, timerInterrupt);
+    if ((timerInterrupt < usElapsed) && (IntrLevel () < 8)) {
       timerInterrupt = DLX_TIMER_NOT_ACTIVE;
       CauseException (DLX_EXC_TIMER);
       return (0);
     }
+  } else {
+    if (mpRunning > 0) {
+      for (i = 1; i < mpCount; i++) {
+	if (mpCpus[i].running) {
+	  MpSwitch (&mpCpus[i]);
+	  mpCpus[i].cpu->ExecOne ();
+	}
+      }
+      MpSwitch (&mpCpus[0]);
+    }
+    simInstrs++;
+    // Increment PC before checking for interrupts because
+    // CauseException will subtract 4 off the PC before placing the
+    // value into the IAR.  By incrementing here, we ensure that the
+    // current instruction is the one whose address goes into the IAR.
+    SetPC (PC() + 4);
+  }
+  // A relaxed load is a plain load, so this costs no more than before.
+  if ((simInstrs >= __atomic_load_n (&nextEvent, __ATOMIC_RELAXED)) &&
+      (mpCur == mpCpus)) {
+    SYNC_SIM_TIME ();
+    if (simInstrs >= eventAt[DLX_EVENT_CKPT]) {
+      eventAt[DLX_EVENT_CKPT] = DLX_EVENT_NEVER;
+      if (ckptRestoreFile != NULL) {
+	if ((m = CheckpointRestore (ckptRestoreFile, this, memSize, usElapsed,
+				    instrsExecuted, timerInterrupt,
+				    fp)) == NULL) {
+	  exit (1);
+	}
+	delete [] memory;
+	memory = m;
+	bulkMemory = (unsigned char *)memory;
+	perfInstrs = instrsExecuted;
+	perfUs = usElapsed;
+	ckptRestoreFile = NULL;
+	if (kbdMode == DLX_KBD_POLL) {
+	  eventAt[DLX_EVENT_KBD] = simInstrs + DLX_KBD_FREQUENCY + 2;
+	}
+      } else {
+	PutIreg (1, CheckpointSave (ckptSaveFile, this, memory, memSize,
+				    usElapsed, instrsExecuted, timerInterrupt,
+				    fp) ? 0 : 0xffffffff);
+      }
+      EventsTimerDeadline (usElapsed, timerInterrupt, usPerInst);
+    }
+    if (simInstrs >= eventAt[DLX_EVENT_PROFILE]) {
+      ProfileRecord (PC()-4, UserMode (), GetSreg (DLX_SREG_PGTBL_BASE));
+      eventAt[DLX_EVENT_PROFILE] = simInstrs + profileInterval;
+      EventsSchedule ();
+    }
+    if (simInstrs >= eventAt[DLX_EVENT_HEATMAP]) {
+      HeatDump (instrsExecuted);
+      eventAt[DLX_EVENT_HEATMAP] = simInstrs + heatInterval;
+      EventsSchedule ();
+    }
+    if (simInstrs >= eventAt[DLX_EVENT_CONSOLE]) {
+      eventAt[DLX_EVENT_CONSOLE] = ConsoleDue () ?
+	DLX_EVENT_NEVER : simInstrs + DLX_CONSOLE_CHECK;
+      EventsSchedule ();
+    }
+    // If the OS is idle, nothing happens until the next interrupt, so
+    // jump the clock to the point where the timer is due.  That's only
+    // safe if the interrupt can actually be taken, and no other CPU
+    // is running.
+    if (idleRequested) {
+      idleRequested = 0;
+      if ((IntrLevel() < 8) && (timerInterrupt != DLX_TIMER_NOT_ACTIVE) &&
+	  (timerInterrupt > usElapsed) && (mpRunning == 0)) {
+	DBPRINTF ('t', "Idle at PC=0x%x: skipping from %.0fus to %.0fus\n",
+		  PC()-4, usElapsed, timerInterrupt);
+	idleUsSkipped += timerInterrupt - usElapsed;
+	usElapsed = timerInterrupt;
+	perfUs = usElapsed;
+      }
+      EventsTimerDeadline (usElapsed, timerInterrupt, usPerInst);
+    }
+    // Check for an input character.  If we got one and interrupts are
+    // enabled, do an interrupt.
+    if (__atomic_load_n (&kbdPending, __ATOMIC_SEQ_CST) &&
+	(KbdTake (kbdbuffer, DLX_KBD_BUFFER_SIZE, kbdwpos,
+		  kbdbufferedchars, kbdLeft) > 0)) {
+      eventAt[DLX_EVENT_KBD] = simInstrs;
+    }
+    if ((kbdMode == DLX_KBD_POLL) && (simInstrs >= eventAt[DLX_EVENT_KBD])) {
+      eventAt[DLX_EVENT_KBD] = simInstrs + DLX_KBD_FREQUENCY + 2;
+      EventsSchedule ();
+      if (GetCharIfAvail () && (IntrLevel () < 8)) {
+	DBPRINTF ('t',"Keyboard interrupt at PC=0x%x, t=%.0fus\n",
+		  PC()-4, usElapsed);
+	CauseException (DLX_EXC_KBD);
+	return (0);
+      }
+    } else if (simInstrs >= eventAt[DLX_EVENT_KBD]) {
+      // Input from the keyboard thread.  If interrupts are masked, or
+      // some of it didn't fit in kbdbuffer, try again later.
+      KbdTake (kbdbuffer, DLX_KBD_BUFFER_SIZE, kbdwpos, kbdbufferedchars,
+	       kbdLeft);
+      if (IntrLevel () < 8) {
+	eventAt[DLX_EVENT_KBD] = (kbdLeft > 0) ?
+	  simInstrs + DLX_KBD_FREQUENCY + 2 : DLX_EVENT_NEVER;
+	EventsSchedule ();
+	DBPRINTF ('t',"Keyboard interrupt at PC=0x%x, t=%.0fus\n",
+		  PC()-4, usElapsed);
+	CauseException (DLX_EXC_KBD);
+	return (0);
+      }
+      eventAt[DLX_EVENT_KBD] = simInstrs + DLX_KBD_FREQUENCY + 2;
+      EventsSchedule ();
+    }
+    if (simInstrs >= eventAt[DLX_EVENT_IPI]) {
+      // Keep checking until the interrupt can be taken.
+      eventAt[DLX_EVENT_IPI] = (IntrLevel () < 8) ?
+	DLX_EVENT_NEVER : simInstrs + 1;
+      EventsSchedule ();
+      if (IntrLevel () < 8) {
+	DBPRINTF ('t', "IPI at PC=0x%x\n", PC()-4);
+	mpCpus[0].ipiPending = 0;
+	CauseException (DLX_EXC_IPI);
+	return (0);
+      }
+    }
+    if (simInstrs >= eventAt[DLX_EVENT_TIMER]) {
+      if ((IntrLevel() < 8) && (timerInterrupt < usElapsed)) {
+	DBPRINTF ('t', "Timer interrupt at PC=0x%x, t=%.0fus, intr@%.0fus\n",
+		  PC()-4, usElapsed, timerInterrupt);
+	timerInterrupt = DLX_TIMER_NOT_ACTIVE;
+	EventsTimerDeadline (usElapsed, timerInterrupt, usPerInst);
+	CauseException (DLX_EXC_TIMER);
+	return (0);
+      }
+      // If the interrupt is due but masked, keep checking on every
+      // instruction until it's taken, just as before.
+      EventsTimerDeadline (usElapsed, timerInterrupt, usPerInst);
+    }
+    if (simInstrs >= eventAt[DLX_EVENT_DISK]) {
+      // Finish every request whose time has come, then interrupt if
+      // any finished requests haven't been collected yet.
+      while ((dmaCount > 0) && (simInstrs >= dmaFinishAt)) {
+	status = DmaFinish ((unsigned char *)memory, memSize, desc);
+	if (desc + 16 < memSize) {
+	  SetMemory (desc + 16, status);
+	  MemoryWritten (desc + 16);
+	}
+	DmaStart (usElapsed, usPerInst);
+      }
+      if (dmaDoneCount > 0) {
+	// Check again on the next instruction, so finished requests the
+	// OS hasn't collected raise the interrupt again once it's unmasked.
+	// The head request still completes at dmaFinishAt.
+	eventAt[DLX_EVENT_DISK] = simInstrs + 1;
+	EventsSchedule ();
+	if (IntrLevel () < 8) {
+	  DBPRINTF ('t', "Disk interrupt at PC=0x%x, t=%.0fus\n",
+		    PC()-4, usElapsed);
+	  CauseException (DLX_EXC_DISK);
+	  return (0);
+	}
+      } else if (eventAt[DLX_EVENT_DISK] != dmaFinishAt) {
+	// All collected: wait for the head request again.
+	eventAt[DLX_EVENT_DISK] = dmaFinishAt;
+	EventsSchedule ();
+      }
+    }
   }
-  if (! ReadWord (PC()-4, curInst, DLX_MEM_INSTR)) {
+  // Translate the PC with the same flags ReadWord would use, then
+  // look for an already decoded copy of the instruction.
+#if USE_ROP
+  if (! VaddrToPaddr (PC()-4, paddr, DLX_MEM_INSTR, 0)) {
+#else
+  if (! VaddrToPaddr (PC()-4, paddr, DLX_MEM_INSTR, DLX_PTE_REFERENCED)) {
+#endif
     DBPRINTF ('I', "Instruction fetch at 0x%x failed!\n", PC()-4);
     return (0);
   }
+  if (cacheModel && (paddr <= memSize)) {
+    CacheAccess (&cacheL1I, paddr, UserMode ());
+  }
+  if (heatPages != NULL) {
+    HeatCount (paddr, DLX_HEAT_FETCHES, UserMode (),
+	       GetSreg (DLX_SREG_PGTBL_BASE));
+  }
+  if (blockExec && (paddr <= memSize)) {
+    b = BlockLookup (paddr);
+    if (b->paddr != paddr) {
+      // Translate the block.  Stop at the end of the chunk, since the
+      // following virtual page may not be physically contiguous.
+      b->paddr = paddr;
+      b->ninstrs = 0;
+      do {
+	curInst = Memory (paddr + 4 * b->ninstrs);
+	b->code[b->ninstrs].paddr = paddr + 4 * b->ninstrs;
+	DecodeInst (&b->code[b->ninstrs], curInst, rrrInstrs, regInstrs,
+		    fpInstrs);
+	b->ninstrs++;
+      } while (! BlockEnds (curInst) &&
+	       (b->ninstrs < DLX_BLOCK_MAX_INSTRS) &&
+	       (((paddr + 4 * b->ninstrs) & (DLX_BLOCK_CHUNK - 1)) != 0));
+      BlockMarkChunk (paddr);
+      DBPRINTF ('I', "Translated block at 0x%x (paddr 0x%x): %d instrs\n",
+		PC()-4, paddr, b->ninstrs);
+    }
+    nextPc = PC();
+    for (i = 0; ; ) {
+      DBPRINTF ('I', "Instr %06d: %08x : %08x (block)\n",
+		(int)(simInstrs % 1000000), b->code[i].inst, PC() - 4);
+      if (statsFp != NULL) {
+	StatsInst (b->code[i].inst);
+      }
+      retval = (b->code[i].exec)(&b->code[i], this);
+      // Stop on a fault, a change of flow, if the instruction wrote
+      // over the block itself, or if the next instruction is due an
+      // event check; the next ExecOne then makes it on time.
+      if ((++i >= b->ninstrs) || (retval == 0) || (PC() != nextPc) ||
+	  (b->paddr != paddr) ||
+	  (simInstrs + 1 >= __atomic_load_n (&nextEvent, __ATOMIC_RELAXED))) {
+	break;
+      }
+      simInstrs++;
+      if (cacheModel) {
+	CacheAccess (&cacheL1I, paddr + 4 * i, UserMode ());
+      }
+      if (heatPages != NULL) {
+	HeatCount (paddr + 4 * i, DLX_HEAT_FETCHES, UserMode (),
+		   GetSreg (DLX_SREG_PGTBL_BASE));
+      }
+      nextPc += 4;
+      SetPC (nextPc);
+    }
+    return (retval);
+  }
+  if (paddr <= memSize) {
+    d = PredecodeEntry (paddr);
+    if (d->paddr == paddr) {
+      DBPRINTF ('I', "Instr %06d: %08x : %08x (predecoded)\n",
+		(int)(simInstrs % 1000000), d->inst, PC() - 4);
+      if (statsFp != NULL) {
+	StatsInst (d->inst);
+      }
+      return ((d->exec)(d, this));
+    }
+    curInst = Memory (paddr);
+  } else {
+    // Fetching from I/O space is never cached.
+    d = NULL;
+    if (! ReadWord (PC()-4, curInst, DLX_MEM_INSTR)) {
+      DBPRINTF ('I', "Instruction fetch at 0x%x failed!\n", PC()-4);
+      return (0);
+    }
+  }
   curOp = (curInst >> DLX_OPCODE_SHIFT) & DLX_OPCODE_MASK;
   DBPRINTF ('I', "Instr %06d: %08x : %08x (main=%02x, aux=%02x)\n",
-	    (int)instrsExecuted % 1000000,
+	    (int)(simInstrs % 1000000),
 	    curInst, PC() - 4, curOp,
 	    (curInst >> DLX_ALU_FUNC_CODE_SHIFT) & DLX_ALU_FUNC_CODE_MASK);
-  switch (curOp) {
-  case 0x00:		// ALU and other R-R operations
-    funcCode = ((curInst >> DLX_ALU_FUNC_CODE_SHIFT) &
-		DLX_ALU_FUNC_CODE_MASK);
-    retval = (rrrInstrs[funcCode].handler)(curInst, this);
-    break;
-  case 0x01:		// FP operations
-    funcCode = ((curInst >> DLX_FPU_FUNC_CODE_SHIFT) &
-		DLX_FPU_FUNC_CODE_MASK);
-    retval = (fpInstrs[funcCode].handler)(curInst, this);
-    break;
-  default:
-    retval = (regInstrs[curOp].handler)(curInst, this);
-    break;
+  DecodeInst (&decoded, curInst, rrrInstrs, regInstrs, fpInstrs);
+  if (d != NULL) {
+    // Fill the cache entry before running the instruction, since the
+    // instruction itself may overwrite (and thus invalidate) it.  It
+    // runs from the local copy for the same reason.
+    *d = decoded;
+    d->paddr = paddr;
   }
+  if (statsFp != NULL) {
+    StatsInst (curInst);
+  }
+  retval = (decoded.exec)(&decoded, this);
   return (retval);
 }
-
+
 //----------------------------------------------------------------------
 //
 //	Cpu::LoadMemory
@@ -2592,7 +5971,9 @@ Cpu::ExecOne ()
 //	Load a file into memory.  The file format consists of a
 //	leading address, followed by a colon, followed by the data
 //	to go at that address.  If the address is omitted, the data
-//	follows that from the previous line of the file.
+//	follows that from the previous line of the file.  Binary
+//	images (see below) are recognized by their magic number and
+//	loaded without any parsing.
 //
 //----------------------------------------------------------------------
 static
@@ -2611,6 +5992,93 @@ getxvalue (int x)
   }
 }
 
+//----------------------------------------------------------------------
+//
+//	Binary memory images
+//
+//	A binary image (made from a .dlx.obj file by dlxobj2bin) is a
+//	header of DLX_BINIMAGE_HDRWORDS big-endian words:
+//
+//		magic ("DLXB"), start, total size,
+//		code start, code size, data start, data size
+//
+//	followed by any number of segments, each an address word, a
+//	length word and that many bytes of memory contents, padded to a
+//	word boundary.  The header carries the same fields as the "start:"
+//	line of a text object file, so the OS can read either format.
+//
+//----------------------------------------------------------------------
+#define	DLX_BINIMAGE_MAGIC	0x444c5842	// "DLXB"
+#define	DLX_BINIMAGE_HDRWORDS	7
+
+static
+inline
+uint32
+BinImageWord (const unsigned char *p)
+{
+  return (((uint32)p[0] << 24) | ((uint32)p[1] << 16) |
+	  ((uint32)p[2] << 8) | (uint32)p[3]);
+}
+
+//----------------------------------------------------------------------
+//
+//	LoadBinaryImage
+//
+//	Map a binary image and copy its segments straight into guest
+//	memory.  Returns the number of bytes loaded, or -1 if the file
+//	isn't a binary image (so the caller can try the text format).
+//
+//----------------------------------------------------------------------
+static
+int
+LoadBinaryImage (const char *file, unsigned char *mem, uint32 msize,
+		 uint32& startAt)
+{
+  int		fd;
+  struct stat	st;
+  unsigned char	*image;
+  size_t	off;
+  uint32	addr, len;
+  int		nread = 0;
+
+  if ((fd = open (file, O_RDONLY)) < 0) {
+    return (-1);
+  }
+  if ((fstat (fd, &st) < 0) ||
+      (st.st_size < (off_t)(DLX_BINIMAGE_HDRWORDS * sizeof (uint32)))) {
+    close (fd);
+    return (-1);
+  }
+  image = (unsigned char *)mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				 fd, 0);
+  close (fd);
+  if (image == (unsigned char *)MAP_FAILED) {
+    return (-1);
+  }
+  if (BinImageWord (image) != DLX_BINIMAGE_MAGIC) {
+    munmap (image, st.st_size);
+    return (-1);
+  }
+  startAt = BinImageWord (image + sizeof (uint32));
+  off = DLX_BINIMAGE_HDRWORDS * sizeof (uint32);
+  while (off + 2 * sizeof (uint32) <= (size_t)st.st_size) {
+    addr = BinImageWord (image + off);
+    len = BinImageWord (image + off + sizeof (uint32));
+    off += 2 * sizeof (uint32);
+    if ((len > (size_t)st.st_size - off) || (addr > msize) ||
+	(len > msize - addr)) {
+      fprintf (stderr, "Bad segment (0x%x bytes at 0x%x) in %s\n",
+	       len, addr, file);
+      break;
+    }
+    memcpy (mem + addr, image + off, len);
+    nread += len;
+    off += (len + sizeof (uint32) - 1) & ~(sizeof (uint32) - 1);
+  }
+  munmap (image, st.st_size);
+  return (nread);
+}
+
 int
 Cpu::LoadMemory (const char *file, uint32& startAt)
 {
@@ -2622,6 +6090,15 @@ Cpu::LoadMemory (const char *file, uint32& startAt)
   uint32	val;
   int		count;
 
+  // Anything decoded from the old memory contents is now stale.
+  PredecodeFlush ();
+  XlateFlush ();
+  BlockFlush ();
+  if ((nread = LoadBinaryImage (file, (unsigned char *)memory, memSize,
+				startAt)) >= 0) {
+    return (nread);
+  }
+  nread = 0;
   if ((fp = fopen (file, "r")) == NULL) {
     return (0);
   }
@@ -2678,7 +6155,13 @@ Cpu::LoadMemory (const char *file, uint32& startAt)
 void
 Cpu::SetTimer (uint32 usecs)
 {
+  SYNC_SIM_TIME ();
   timerInterrupt = usElapsed + (double)usecs;
+  // Other CPUs check their timers on every instruction; the timer
+  // event is CPU 0's.
+  if (mpCur == mpCpus) {
+    EventsTimerDeadline (usElapsed, timerInterrupt, usPerInst);
+  }
 }
 
 //----------------------------------------------------------------------
@@ -2692,6 +6175,7 @@ uint32
 Cpu::Timerget()
 {
    unsigned int result;
+   SYNC_SIM_TIME ();
    result = (unsigned int)(usElapsed/1e3);
    SetResult (result);
 }
@@ -2743,6 +6227,19 @@ Cpu::OutputBasicBlockActual ()
   int		i, ninstrs;
 
   ninstrs = (PC() - basicBlockStart) >> 2;
+  if (traceBinary) {
+    if (flags & DLX_TRACE_INSTRUCTIONS) {
+      TraceBinaryBlock (basicBlockStart, ninstrs);
+    }
+    if (flags & DLX_TRACE_MEMORY) {
+      for (i = 0; i < naccesses; i++) {
+	TraceBinaryAccess (accesses[i].inst, accesses[i].reg,
+			   accesses[i].addr, accesses[i].value);
+      }
+    }
+    naccesses = 0;
+    return;
+  }
   // Print out the basic block information here
   if (flags & DLX_TRACE_INSTRUCTIONS) {
     fprintf (tracefp, "I %x %d\n", basicBlockStart, ninstrs);
@@ -0,0 +1,205 @@
+//
+//	dlxtrace.cc
+//
+//	Print a binary trace (written by dlxsim with DLXSIM_TRACE_BINARY
+//	set) in the usual text trace format, so the same analysis scripts
+//	work on either.
+//
+//	Usage: dlxtrace [trace.bin]	(reads stdin if no file is given)
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "dlxtrace.h"
+
+typedef unsigned int uint32;
+
+static
+int
+GetWord (FILE *fp, uint32& w)
+{
+  unsigned char	b[4];
+
+  if (fread (b, 1, 4, fp) != 4) {
+    return (0);
+  }
+  w = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+  return (1);
+}
+
+//----------------------------------------------------------------------
+//
+//	Decompress
+//
+//	Undo TraceCompress.  Returns 1 if the block decoded to exactly
+//	n bytes.
+//
+//----------------------------------------------------------------------
+static
+int
+Decompress (const unsigned char *in, uint32 stored, unsigned char *out,
+	    uint32 n)
+{
+  uint32	i = 0, o = 0, len, dist;
+
+  while (i < stored) {
+    if (in[i] < 0x80) {
+      len = in[i++] + 1;
+      if ((i + len > stored) || (o + len > n)) {
+	return (0);
+      }
+      memcpy (out + o, in + i, len);
+      i += len;
+    } else {
+      len = (in[i] & 0x7f) + DLX_TRACE_LZ_MINMATCH;
+      if (i + 3 > stored) {
+	return (0);
+      }
+      dist = (in[i+1] << 8) | in[i+2];
+      i += 3;
+      if ((dist == 0) || (dist > o) || (o + len > n)) {
+	return (0);
+      }
+      // Copies may overlap their own output, so go a byte at a time.
+      for (uint32 k = 0; k < len; k++) {
+	out[o + k] = out[o - dist + k];
+      }
+    }
+    o += len;
+  }
+  return (o == n);
+}
+
+static
+inline
+uint32
+GetVarint (const unsigned char *&p)
+{
+  uint32	v = 0;
+  int		shift = 0;
+
+  while (*p & 0x80) {
+    v |= (*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  v |= *p++ << shift;
+  return (v);
+}
+
+static
+inline
+uint32
+GetDelta (const unsigned char *&p, uint32& last)
+{
+  uint32	z = GetVarint (p);
+
+  last += (z >> 1) ^ -(z & 1);
+  return (last);
+}
+
+//----------------------------------------------------------------------
+//
+//	PrintBlock
+//
+//	Print the records in one (uncompressed) block.  Returns 0 if the
+//	block is corrupt.
+//
+//----------------------------------------------------------------------
+static
+int
+PrintBlock (const unsigned char *p, uint32 n)
+{
+  const unsigned char *end = p + n;
+  uint32	lastBlock = 0, lastAddr = 0;
+  uint32	a, b, reg, nameLen;
+  char		name[256];
+
+  while (p < end) {
+    switch (*p++) {
+    case DLX_TRACE_REC_BLOCK:
+      a = GetDelta (p, lastBlock);
+      b = GetVarint (p);
+      printf ("I %x %d\n", a, b);
+      break;
+    case DLX_TRACE_REC_ACCESS:
+    case DLX_TRACE_REC_ACCESS_NAME:
+      if (p[-1] == DLX_TRACE_REC_ACCESS) {
+	if (*p >= DLX_TRACE_NACCESSNAMES) {
+	  return (0);
+	}
+	strcpy (name, dlxTraceAccessNames[*p++]);
+      } else {
+	nameLen = *p++;
+	memcpy (name, p, nameLen);
+	name[nameLen] = '\0';
+	p += nameLen;
+      }
+      reg = *p++;
+      a = GetDelta (p, lastAddr);
+      b = GetVarint (p);
+      printf ("%s r%d %x %x\n", name, reg, a, b);
+      break;
+    case DLX_TRACE_REC_TRAP:
+      a = GetVarint (p);
+      b = GetVarint (p);
+      printf ("T %x %x\n", a, b);
+      break;
+    case DLX_TRACE_REC_RFE:
+      a = GetVarint (p);
+      b = GetVarint (p);
+      printf ("R %x %x\n", a, b);
+      break;
+    case DLX_TRACE_REC_EXC:
+      a = GetVarint (p);
+      b = GetVarint (p);
+      printf ("X %x %x\n", a, b);
+      break;
+    default:
+      return (0);
+    }
+  }
+  return (p == end);
+}
+
+int
+main (int argc, char *argv[])
+{
+  FILE		*fp = stdin;
+  uint32	magic, version, len, stored, method;
+  unsigned char	*in = new unsigned char[DLX_TRACE_BLOCK_SIZE];
+  unsigned char	*raw = new unsigned char[DLX_TRACE_BLOCK_SIZE];
+  int		nblocks = 0;
+
+  if ((argc > 1) && ((fp = fopen (argv[1], "r")) == NULL)) {
+    perror (argv[1]);
+    exit (1);
+  }
+  if (!GetWord (fp, magic) || !GetWord (fp, version) ||
+      (magic != DLX_TRACE_MAGIC) || (version != DLX_TRACE_VERSION)) {
+    fprintf (stderr, "Not a binary DLX trace.\n");
+    exit (1);
+  }
+  while (GetWord (fp, len)) {
+    if (!GetWord (fp, stored) || !GetWord (fp, method) ||
+	(len > DLX_TRACE_BLOCK_SIZE) || (stored > DLX_TRACE_BLOCK_SIZE) ||
+	(fread (in, 1, stored, fp) != stored)) {
+      fprintf (stderr, "Trace truncated in block %d.\n", nblocks);
+      exit (1);
+    }
+    if (method == DLX_TRACE_METHOD_LZ) {
+      if (!Decompress (in, stored, raw, len)) {
+	fprintf (stderr, "Bad compressed data in block %d.\n", nblocks);
+	exit (1);
+      }
+    } else {
+      memcpy (raw, in, len);
+    }
+    if (!PrintBlock (raw, len)) {
+      fprintf (stderr, "Bad record in block %d.\n", nblocks);
+      exit (1);
+    }
+    nblocks++;
+  }
+  return (0);
+}
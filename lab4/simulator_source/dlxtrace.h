@@ -0,0 +1,65 @@
+//
+//	dlxtrace.h
+//
+//	Binary trace format, written by dlxsim (when DLXSIM_TRACE_BINARY
+//	is set) and turned back into the text trace format by dlxtrace.
+//
+//	A trace is a header of two big-endian words (magic, version)
+//	followed by blocks.  Each block is three big-endian words (raw
+//	length, stored length, method) and then the stored bytes, which
+//	are the raw records either as is or LZ compressed.  Addresses are
+//	delta encoded from the previous record of the same kind, starting
+//	from 0 in each block, so blocks can be decoded independently.
+//
+//	Records are a tag byte followed by unsigned LEB128 varints (deltas
+//	are zigzag encoded first):
+//
+//		DLX_TRACE_REC_BLOCK	delta(start), ninstrs	  "I %x %d"
+//		DLX_TRACE_REC_ACCESS	inst, reg, delta(addr), value
+//					  "%s r%d %x %x"
+//		DLX_TRACE_REC_ACCESS_NAME  as ACCESS, but inst is a length
+//					  and that many name bytes
+//		DLX_TRACE_REC_TRAP	vector, pc		  "T %x %x"
+//		DLX_TRACE_REC_RFE	pc, iar			  "R %x %x"
+//		DLX_TRACE_REC_EXC	type, pc		  "X %x %x"
+//
+//	The LZ method is a stream of tokens.  A token byte below 0x80 is
+//	followed by (token + 1) literal bytes; otherwise it's a copy of
+//	((token & 0x7f) + DLX_TRACE_LZ_MINMATCH) bytes from a big-endian
+//	16 bit distance back in the output.
+//
+
+#ifndef	_DLXTRACE_H_
+#define	_DLXTRACE_H_
+
+#define	DLX_TRACE_MAGIC		0x444c5854	// "DLXT"
+#define	DLX_TRACE_VERSION	1
+
+// Blocks never hold more than this many raw bytes.
+#define	DLX_TRACE_BLOCK_SIZE	65536
+
+#define	DLX_TRACE_METHOD_RAW	0
+#define	DLX_TRACE_METHOD_LZ	1
+
+#define	DLX_TRACE_REC_BLOCK	1
+#define	DLX_TRACE_REC_ACCESS	2
+#define	DLX_TRACE_REC_ACCESS_NAME 3
+#define	DLX_TRACE_REC_TRAP	4
+#define	DLX_TRACE_REC_RFE	5
+#define	DLX_TRACE_REC_EXC	6
+
+#define	DLX_TRACE_LZ_MINMATCH	4
+#define	DLX_TRACE_LZ_MAXMATCH	(0x7f + DLX_TRACE_LZ_MINMATCH)
+#define	DLX_TRACE_LZ_MAXLIT	0x80
+
+// Names of the memory access records, as passed to Cpu::TraceAccess.
+// ACCESS records store the index into this table.
+static const char *dlxTraceAccessNames[] = {
+  "lw", "lh", "lhu", "lb", "lbu", "sw", "sh", "sb",
+  "lf", "sf", "ld0", "ld1", "sd0", "sd1", "ll", "sc",
+};
+
+#define	DLX_TRACE_NACCESSNAMES	\
+  (int)(sizeof (dlxTraceAccessNames) / sizeof (dlxTraceAccessNames[0]))
+
+#endif	// _DLXTRACE_H_
@@ -0,0 +1,54 @@
+//
+//	memstress.c
+//
+//	Microbenchmark for the simulator's handling of the page table
+//	referenced/dirty bits.  It does nothing but translated loads and
+//	stores to the same few pages, which is where writing the PTE back
+//	on every access used to cost the most.  Run it on its own:
+//
+//		dlxsim -x os.dlx.obj -a -u memstress.dlx.obj [passes]
+//
+//	and compare the "Execution rate" line dlxsim prints at exit
+//	between simulator versions, or with DLXSIM_PTE_AD=off (which
+//	never sets the bits).  The simulated counts printed here should
+//	be the same every time; only the host time changes.
+//
+
+#include "usertraps.h"
+#include "misc.h"
+
+#define MEMSTRESS_WORDS 1000
+#define MEMSTRESS_PASSES 2000
+
+void main (int argc, char *argv[])
+{
+  int arr[MEMSTRESS_WORDS];
+  int passes = MEMSTRESS_PASSES;
+  int pass, i, sum = 0;
+  unsigned int instrs, us, loads, stores;
+
+  if (argc > 1) {
+    passes = dstrtol(argv[1], NULL, 10);
+  }
+  instrs = PerfCounter(PERF_INSTRS_LO);
+  us = PerfCounter(PERF_US_LO);
+  loads = PerfCounter(PERF_LOADS);
+  stores = PerfCounter(PERF_STORES);
+
+  for (pass = 0; pass < passes; pass++) {
+    for (i = 0; i < MEMSTRESS_WORDS; i++) {
+      arr[i] = pass + i;
+    }
+    for (i = 0; i < MEMSTRESS_WORDS; i++) {
+      sum += arr[i];
+    }
+  }
+
+  instrs = PerfCounter(PERF_INSTRS_LO) - instrs;
+  us = PerfCounter(PERF_US_LO) - us;
+  loads = PerfCounter(PERF_LOADS) - loads;
+  stores = PerfCounter(PERF_STORES) - stores;
+  Printf("memstress (%d): %d passes, sum %d\n", getpid(), passes, sum);
+  Printf("memstress (%d): %u instrs, %u loads, %u stores, %u us\n",
+	 getpid(), instrs, loads, stores, us);
+}
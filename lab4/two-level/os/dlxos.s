@@ -335,3 +335,35 @@ _ProcessSleep:
 	nop
 .endproc _ProcessSleep
 
+
+;;;----------------------------------------------------------------------
+;;; SpinTryLock
+;;;
+;;; Try once to take the spinlock whose address is passed: if it's 0,
+;;; set it to 1 with ll/sc (load-linked and store-conditional) and
+;;; return 1.  Return 0 if the lock was held or another CPU got in
+;;; first.  The assembler doesn't know ll and sc, so they're written
+;;; out as words.
+;;;----------------------------------------------------------------------
+.proc _SpinTryLock
+.global _SpinTryLock
+_SpinTryLock:
+	subui	r29,r29,#16
+	sw	8(r29),r2	; save r2
+	sw	12(r29),r3	; save r3
+	lw	r2,16(r29)	; Get the address of the lock
+	.word	0xc0410000	; ll r1,0(r2)
+	bnez	r1,spinHeld
+	addi	r3,r0,#1
+	.word	0xe0430000	; sc r3,0(r2): r3 = 1 if it was stored
+	add	r1,r3,r0
+	j	spinDone
+spinHeld:
+	add	r1,r0,r0
+spinDone:
+	lw	r2,8(r29)	; restore r2
+	lw	r3,12(r29)	; restore r3
+	addui	r29,r29,#16	; restore stack pointer
+	jr	r31
+	nop
+.endproc _SpinTryLock
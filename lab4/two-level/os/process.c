@@ -53,6 +53,22 @@ int ProcessGetCodeInfo(const char *file, uint32 *startAddr, uint32 *codeStart, u
 int ProcessGetFromFile(int fd, unsigned char *buf, uint32 *addr, int max);
 uint32 get_argument(char *string);
 
+// Programs may also be stored as binary images (made by dlxobj2bin in the
+// simulator sources).  These start with a header of big-endian words
+// (magic, start, total size, code start/size, data start/size) followed
+// by segments of address, length and raw bytes (padded to a word), so
+// they are copied in a block at a time instead of being hex-decoded.
+#define PROCESS_BINIMAGE_MAGIC		"DLXB"
+#define PROCESS_BINIMAGE_HDRWORDS	7
+#define PROCESS_LOAD_BLOCKSIZE		4096
+
+// State of the binary image currently being loaded.  Only one program is
+// loaded at a time, so these can be shared.
+static int	processLoadBinary = 0;
+static uint32	processLoadSegLeft = 0;
+static uint32	processLoadPad = 0;
+static unsigned char processLoadBuf[PROCESS_LOAD_BLOCKSIZE];
+
 
 
 //----------------------------------------------------------------------
@@ -392,7 +408,6 @@ int ProcessFork (VoidFunc func, uint32 param, char *name, int isUser) {
   int start, codeS, codeL; // Used for reading code from files.
   int dataS, dataL;        // Used for reading code from files.
   int addr = 0;            // Used for reading code from files.
-  unsigned char buf[100];  // Used for reading code from files.
   uint32 *stackframe;      // Stores address of current stack frame.
   PCB *pcb;                // Holds pcb while we build it for this process.
   int intrs;               // Stores previous interrupt settings.
@@ -573,11 +588,12 @@ int ProcessFork (VoidFunc func, uint32 param, char *name, int isUser) {
     dbprintf ('p', "File %s -> data @ 0x%08x (size=0x%08x)\n", name, dataS,
 	      dataL);
 
-    while ((n = ProcessGetFromFile (fd, buf, &addr, sizeof (buf))) > 0) {
+    while ((n = ProcessGetFromFile (fd, processLoadBuf, &addr,
+				    sizeof (processLoadBuf))) > 0) {
       dbprintf ('p', "Placing %d bytes at vaddr %08x.\n", n, addr - n);
       // Copy the data to user memory.  Note that the user memory needs to
       // have enough space so that this copy will succeed!
-      MemoryCopySystemToUser (pcb, buf, (char *)(addr - n), n);
+      MemoryCopySystemToUser (pcb, processLoadBuf, (char *)(addr - n), n);
     }
     FsClose (fd);
     stackframe[PROCESS_STACK_ISR] = PROCESS_INIT_ISR_USER;
@@ -756,7 +772,8 @@ ProcessGetCodeInfo (const char *file, uint32 *startAddr,
 {
   int		fd;
   int		totalsize;
-  char		buf[100];
+  uint32	hdr[25];	// Word-aligned so binary headers can be read in place
+  char		*buf = (char *)hdr;
   char		*pos;
 
   // Open the file for reading.  If it returns a negative number, the open
@@ -767,12 +784,25 @@ ProcessGetCodeInfo (const char *file, uint32 *startAddr,
     return (-1);
   }
   dbprintf ('f', "File descriptor is now %d.\n", fd);
-  if ((totalsize = FsRead (fd, buf, sizeof (buf))) != sizeof (buf)) {
+  if ((totalsize = FsRead (fd, buf, sizeof (hdr))) != sizeof (hdr)) {
     dbprintf ('f', "ProcessGetCodeInfo: read got %d (not %d) bytes from %s\n",
-	      totalsize, (int)sizeof (buf), file);
+	      totalsize, (int)sizeof (hdr), file);
     FsClose (fd);
     return (-1);
   }
+  if (dstrncmp (buf, PROCESS_BINIMAGE_MAGIC, 4) == 0) {
+    // Binary image: the header words are already in our byte order.
+    *startAddr = hdr[1];
+    *codeStart = hdr[3];
+    *codeSize = hdr[4];
+    *dataStart = hdr[5];
+    *dataSize = hdr[6];
+    processLoadBinary = 1;
+    processLoadSegLeft = 0;
+    FsSeek (fd, PROCESS_BINIMAGE_HDRWORDS * sizeof (uint32), FS_SEEK_SET);
+    return (fd);
+  }
+  processLoadBinary = 0;
   if (dstrstr (buf, "start:") == NULL) {
     dbprintf ('f', "ProcessGetCodeInfo: %s missing start line (not a DLX executable?)\n", file);
     return (-1);
@@ -815,9 +845,45 @@ ProcessGetCodeInfo (const char *file, uint32 *startAddr,
 //	Load a file into memory.  The file format consists of a
 //	leading address, followed by a colon, followed by the data
 //	to go at that address.  If the address is omitted, the data
-//	follows that from the previous line of the file.
+//	follows that from the previous line of the file.  Binary
+//	images (see ProcessGetCodeInfo) are handed to ProcessGetFromBinary
+//	instead, which reads up to a block of raw bytes at a time.
 //
 //----------------------------------------------------------------------
+static int
+ProcessGetFromBinary (int fd, unsigned char *buf, uint32 *addr, int max)
+{
+  uint32	seghdr[2];
+  int		nbytes;
+
+  if (processLoadSegLeft == 0) {
+    if (FsRead (fd, (char *)seghdr, sizeof (seghdr)) != sizeof (seghdr)) {
+      return (0);
+    }
+    *addr = seghdr[0];
+    processLoadSegLeft = seghdr[1];
+    processLoadPad = (sizeof (uint32) - (seghdr[1] & 0x3)) & 0x3;
+  }
+  // Don't cross a block boundary, so each chunk lands in a single page.
+  if (max > PROCESS_LOAD_BLOCKSIZE - (*addr & (PROCESS_LOAD_BLOCKSIZE - 1))) {
+    max = PROCESS_LOAD_BLOCKSIZE - (*addr & (PROCESS_LOAD_BLOCKSIZE - 1));
+  }
+  if (max > processLoadSegLeft) {
+    max = processLoadSegLeft;
+  }
+  if ((nbytes = FsRead (fd, (char *)buf, max)) <= 0) {
+    return (0);
+  }
+  processLoadSegLeft -= nbytes;
+  *addr += nbytes;
+  if ((processLoadSegLeft == 0) && (processLoadPad != 0)) {
+    FsSeek (fd, processLoadPad, FS_SEEK_CUR);
+  }
+  dbprintf ('f', "Read %d binary bytes, next address 0x%x.\n", nbytes,
+	    (int)(*addr));
+  return (nbytes);
+}
+
 int
 ProcessGetFromFile (int fd, unsigned char *buf, uint32 *addr, int max)
 {
@@ -827,6 +893,9 @@ ProcessGetFromFile (int fd, unsigned char *buf, uint32 *addr, int max)
   unsigned char *pos = buf;
   char	*lpos = localbuf;
 
+  if (processLoadBinary) {
+    return (ProcessGetFromBinary (fd, buf, addr, max));
+  }
   // Remember our position at the start of the routine so we can adjust
   // it later.
   seekpos = FsSeek (fd, 0, FS_SEEK_CUR);
@@ -1020,6 +1089,12 @@ void main (int argc, char *argv[])
   } else {
     dbprintf('i', "No user program passed!\n");
   }
+  // The OS is booted and the first program loaded.  If the simulator was
+  // asked to, it snapshots everything here, and later runs can resume
+  // from this point instead of booting again.
+  if (checkpoint () > 0) {
+    dbprintf ('i', "Resumed from a simulator checkpoint.\n");
+  }
   /* printf("start clock\n"); */
   ClkStart();
 
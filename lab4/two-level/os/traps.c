@@ -255,6 +255,7 @@ static void TrapPrintfHandler(uint32 *trapArgs, int sysMode) {
                   }
                   numargs += 2; // numargs is incremented by 2 since a double is the size of 2 ints
           break;
+        case 'u': // unsigned integers, same size as %d
         case 'd': // integers
                   if (!sysMode) {
                     MemoryCopyUserToSystem(currentPCB, (char *)(trapArgs+numargs+1), (char *)&(args[numargs]), sizeof(int));
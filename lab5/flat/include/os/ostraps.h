@@ -18,6 +18,35 @@ int close(int fd);
 void bcopy(char *source, char *destination, int numbytes);
 void exitsim();
 void TimerSet(int us);
+int bulkmove(void *dst, const void *src, int numbytes);
+int bulkset(void *dst, int c, int numbytes);
+unsigned int perfcounter(int counter);
+
+// Performance counters, for perfcounter().  Instructions and
+// microseconds are 64 bits, read as two halves.  PERF_EXC + cause
+// counts exceptions with that cause (below 0x7f); PERF_EXC_TRAPS
+// counts all traps.
+#define PERF_INSTRS_LO 16
+#define PERF_INSTRS_HI 17
+#define PERF_US_LO 18
+#define PERF_US_HI 19
+#define PERF_WALKS 20
+#define PERF_LOADS 21
+#define PERF_STORES 22
+#define PERF_EXC 0x100
+#define PERF_EXC_TRAPS (PERF_EXC + 0x7f)
+
+unsigned int heatcount(int counter);
+
+// Page heat map counts, for heatcount(HEAT_COUNTER(page, kind)).  The
+// page is a physical page number (4KB pages unless the simulator is
+// told otherwise).  HEAT_SWITCHES counts user accesses made from a
+// different address space than the previous one to the page.
+#define HEAT_READS 0
+#define HEAT_WRITES 1
+#define HEAT_FETCHES 2
+#define HEAT_SWITCHES 3
+#define HEAT_COUNTER(page, kind) (((page) << 2) | (kind))
 
 
 #endif
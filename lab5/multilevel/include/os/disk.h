@@ -19,6 +19,27 @@ typedef struct disk_block {
 #define DISK_SUCCESS 1
 #define DISK_FAIL -1
 
+// A request for the simulator's DMA disk (DLXSIM_DISK).  The descriptor
+// must stay put until status is no longer DISK_DMA_PENDING.
+typedef struct disk_dma {
+  uint32 op;           // DISK_DMA_READ or DISK_DMA_WRITE
+  uint32 blocknum;     // first block
+  uint32 paddr;        // physical address of the buffer
+  uint32 nblocks;
+  volatile uint32 status;
+} disk_dma;
+
+// Set to 1 to use the DMA disk when the simulator has one.  Probing for
+// it reads a device register that older simulators don't have, and
+// that fault kills the OS, so it's off unless the dlxsim being run is
+// known to support it.
+#define DISK_USE_DMA 0
+
+#define DISK_DMA_READ 1
+#define DISK_DMA_WRITE 2
+#define DISK_DMA_PENDING 0
+#define DISK_DMA_DONE 1
+
 int DiskBytesPerBlock();
 int DiskSize();
 int DiskCreate();
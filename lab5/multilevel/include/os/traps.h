@@ -37,6 +37,7 @@
 #define	TRAP_TLBFAULT		0x30
 #define	TRAP_TIMER		0x40	// timer interrupt
 #define	TRAP_KBD		0x48	// keyboard interrupt
+#define	TRAP_DISK		0x50	// DMA disk request finished
 
 // This bit is set in CAUSE if the interrupt was a trap instruction
 #define	TRAP_TRAP_INSTR		0x08000000
@@ -113,6 +114,11 @@
 #define	DLX_KBD_GETCHAR		0xfff00180
 #define	DLX_KBD_NCHARSIN	0xfff001a0
 #define	DLX_KBD_INTR		0xfff001c0
+#define	DLX_DMA_QUEUE		0xfff00500	// write: queue a descriptor
+#define	DLX_DMA_DONE		0xfff00504	// read: next finished descriptor
+#define	DLX_DMA_PENDING		0xfff00508	// read: requests outstanding
+#define	DLX_DMA_NBLOCKS		0xfff0050c	// read: 0 if there's no DMA disk
+#define	DLX_DMA_BLOCKSIZE	0xfff00510
 
 #define	TRAP_STACK_SIZE		0x800	// interrupt stack is 2K words
 
@@ -554,6 +554,7 @@ static void TrapPrintfHandler(uint32 *trapArgs, int sysMode) {
                   }
                   numargs += 2; // numargs is incremented by 2 since a double is the size of 2 ints
           break;
+        case 'u': // unsigned integers, same size as %d
         case 'd': // integers
         case 'x': // integers
                   if (!sysMode) {
@@ -885,6 +886,13 @@ dointerrupt (unsigned int cause, unsigned int iar, unsigned int isr,
 		result, result, i);
       } while (i > 1);
       break;
+    case TRAP_DISK:
+      // DiskReadBlock/DiskWriteBlock wait on the status word, so all
+      // that's left to do is collect the finished descriptors.
+      while ((result = *((uint32 *)DLX_DMA_DONE)) != 0) {
+	dbprintf ('d', "Disk DMA request 0x%x finished\n", result);
+      }
+      break;
     case TRAP_ACCESS:
       printf ("Exiting after illegal access at iar=0x%x, isr=0x%x\n",
 	      iar, isr);